@@ -74,7 +74,7 @@ namespace blender {
       const auto w = render_width();
       const auto h = render_height();
 
-      auto tiles = job::tiles_t::make(w, h, 32, buffer_format);
+      auto tiles = job::tiles_t::make(w, h, renderer.options, buffer_format);
       auto sink = new sink_t(engine, view, layer, w, h);
       auto sampler = new sampler_t(renderer.options);
 
@@ -112,6 +112,8 @@ namespace blender {
       renderer.options.samples_per_pixel = RNA_int_get(&pscene, "samples_per_pixel");
       renderer.options.paths_per_sample = RNA_int_get(&pscene, "paths_per_sample");
       renderer.options.path_depth = RNA_int_get(&pscene, "max_path_depth");
+      // the viewport shows a noisy image of the whole frame early on
+      renderer.options.progressive = (bool) rv3d;
     }
 
     void init_sub_systems(const std::string& path) {
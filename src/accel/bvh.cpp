@@ -4,21 +4,107 @@
 #include "triangle.hpp"
 #include "utils/aligned_allocator.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
 #include <set>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace accel {
   struct mbvh_t::details_t {
     typedef mbvh::node_t<mbvh_t::width> node_t;
     typedef triangle::moeller_trumbore_t<mbvh_t::width> triangle_t;
 
+    typedef mbvh::compressed_node_t<mbvh_t::width> compressed_node_t;
+
     typedef std::vector<node_t, aligned_allocator<node_t, 32>> nodes_t;
     typedef std::vector<triangle_t, aligned_allocator<triangle_t, 32>> triangles_t;
+    typedef std::vector<compressed_node_t, aligned_allocator<compressed_node_t, 64>> compressed_nodes_t;
 
     nodes_t nodes;
     triangles_t triangles;
+    compressed_nodes_t compressed;
+
+    // file mapping, if the tree was loaded from a cache
+    void*  mapping;
+    size_t mapping_size;
+
+    inline details_t()
+      : mapping(nullptr)
+      , mapping_size(0)
+    {}
+
+    inline ~details_t() {
+      unmap();
+    }
+
+    inline void unmap() {
+      if (mapping) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+      }
+    }
   };
 
+  /* layout of a cached tree on disk. the header is followed by the
+   * node array, and the triangle array, both starting at cache line
+   * aligned offsets, so they can be used directly from the mapping */
+  struct cache_header_t {
+    char     magic[8];
+    uint64_t key;
+    uint32_t node_size;
+    uint32_t triangle_size;
+    uint32_t num_nodes;
+    uint32_t num_triangles;
+    uint64_t nodes_offset;
+    uint64_t triangles_offset;
+    uint64_t size;
+  };
+
+  static const char CACHE_MAGIC[8] = { 'P', 'H', 'O', 'S', 'B', 'V', 'H', '\0' };
+
+  static inline uint64_t cache_align(uint64_t offset) {
+    return (offset + 63) & ~((uint64_t) 63);
+  }
+
+  /* walk the tree to find its depth. empty child slots don't point
+   * anywhere, and get skipped */
+  static uint32_t measure_depth(const mbvh::node_t<mbvh_t::width>* nodes, uint32_t num_nodes) {
+    if (!nodes || num_nodes == 0) {
+      return 0;
+    }
+
+    uint32_t depth = 0;
+
+    std::vector<std::pair<uint32_t, uint32_t>> todo;
+    todo.emplace_back(0, 1);
+
+    while (!todo.empty()) {
+      const auto cur = todo.back();
+      todo.pop_back();
+
+      depth = std::max(depth, cur.second);
+
+      const auto& node = nodes[cur.first];
+      for (auto i=0; i<mbvh_t::width; ++i) {
+        if (!node.is_leaf(i) && !node.is_empty(i)) {
+          todo.emplace_back(node.offset[i], cur.second + 1);
+        }
+      }
+    }
+
+    return depth;
+  }
+
   struct builder_t :
     public bvh::builder_t<
       mbvh_t::details_t::node_t
@@ -29,6 +115,10 @@ namespace accel {
 
     mbvh_t* bvh;
 
+    // guards the node and triangle storage against concurrent builds
+    // of sub trees
+    std::mutex m;
+
     mbvh_t::details_t::nodes_t& nodes;
     mbvh_t::details_t::triangles_t& triangles;
 
@@ -43,10 +133,14 @@ namespace accel {
       bvh->root      = nodes.data();
       bvh->triangles = triangles.data();
 
+      bvh->num_nodes     = nodes.size();
       bvh->num_triangles = triangles.size();
+
+      bvh->depth = measure_depth(bvh->root, bvh->num_nodes);
     }
 
     uint32_t make_node() {
+      std::lock_guard<std::mutex> lock(m);
       nodes.emplace_back(/* constructor args would go here */);
       return nodes.size() - 1;
     }
@@ -55,12 +149,19 @@ namespace accel {
       return nodes[n];
     }
 
+    void commit(uint32_t n, const mbvh_t::details_t::node_t& node) {
+      std::lock_guard<std::mutex> lock(m);
+      nodes[n] = node;
+    }
+
     uint32_t add(
       uint32_t begin
     , uint32_t end
     , const std::vector<bvh::primitive_t>& primitives
     , const std::vector<triangle_t>& things)
     {
+      std::lock_guard<std::mutex> lock(m);
+
       uint32_t off = triangles.size();
 
       const triangle_t* tris[mbvh_t::width];
@@ -79,7 +180,13 @@ namespace accel {
   };
 
   mbvh_t::mbvh_t()
-    : details(new details_t()) {
+    : details(new details_t())
+    , root(nullptr)
+    , num_nodes(0)
+    , depth(0)
+    , compressed(nullptr)
+    , triangles(nullptr)
+    , num_triangles(0) {
   }
 
   mbvh_t::~mbvh_t() {
@@ -89,14 +196,160 @@ namespace accel {
   void mbvh_t::reset() {
     details->nodes.clear();
     details->triangles.clear();
+    details->compressed.clear();
+    details->unmap();
 
     triangles = nullptr;
     root = nullptr;
+    compressed = nullptr;
 
     num_nodes = 0;
+    depth = 0;
     num_triangles = 0;
   }
 
+  bool mbvh_t::load(const std::string& path, uint64_t key) {
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < sizeof(cache_header_t)) {
+      close(fd);
+      return false;
+    }
+
+    const auto size = (size_t) info.st_size;
+    auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+      std::cerr << "Failed to map BVH cache: " << path << std::endl;
+      return false;
+    }
+
+    const auto* header = (const cache_header_t*) mapping;
+
+    const auto valid =
+      memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+      header->key == key &&
+      header->node_size == sizeof(details_t::node_t) &&
+      header->triangle_size == sizeof(details_t::triangle_t) &&
+      header->size == size &&
+      header->nodes_offset + header->num_nodes * sizeof(details_t::node_t) <= size &&
+      header->triangles_offset + header->num_triangles * sizeof(details_t::triangle_t) <= size;
+
+    if (!valid) {
+      std::cerr << "Ignoring invalid BVH cache: " << path << std::endl;
+      munmap(mapping, size);
+      return false;
+    }
+
+    reset();
+
+    details->mapping      = mapping;
+    details->mapping_size = size;
+
+    root      = (mbvh::node_t<width>*) ((char*) mapping + header->nodes_offset);
+    triangles = (triangle_t*) ((char*) mapping + header->triangles_offset);
+
+    num_nodes     = header->num_nodes;
+    num_triangles = header->num_triangles;
+
+    depth = measure_depth(root, num_nodes);
+
+    return true;
+  }
+
+  bool mbvh_t::store(const std::string& path, uint64_t key) const {
+    cache_header_t header;
+    memset(&header, 0, sizeof(cache_header_t));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+
+    header.key              = key;
+    header.node_size        = sizeof(details_t::node_t);
+    header.triangle_size    = sizeof(details_t::triangle_t);
+    header.num_nodes        = num_nodes;
+    header.num_triangles    = num_triangles;
+    header.nodes_offset     = cache_align(sizeof(cache_header_t));
+    header.triangles_offset = cache_align(header.nodes_offset + num_nodes * sizeof(details_t::node_t));
+    header.size             = header.triangles_offset + num_triangles * sizeof(details_t::triangle_t);
+
+    // write to a temporary file first, so concurrent renders never
+    // see a partially written cache
+    const auto tmp = path + ".tmp." + std::to_string(getpid());
+
+    auto file = fopen(tmp.c_str(), "wb");
+    if (!file) {
+      std::cerr << "Failed to write BVH cache: " << path << std::endl;
+      return false;
+    }
+
+    const auto write = [&](const void* data, size_t size, uint64_t offset) {
+      return
+        fseek(file, offset, SEEK_SET) == 0 &&
+        (size == 0 || fwrite(data, size, 1, file) == 1);
+    };
+
+    const auto ok =
+      write(&header, sizeof(cache_header_t), 0) &&
+      write(root, num_nodes * sizeof(details_t::node_t), header.nodes_offset) &&
+      write(triangles, num_triangles * sizeof(details_t::triangle_t), header.triangles_offset);
+
+    if (fclose(file) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+      std::cerr << "Failed to write BVH cache: " << path << std::endl;
+      unlink(tmp.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  void mbvh_t::compress() {
+    if (!root) {
+      return;
+    }
+
+    auto& out = details->compressed;
+
+    out.clear();
+    out.reserve(num_nodes);
+
+    for (auto i=0; i<num_nodes; ++i) {
+      out.emplace_back(root[i]);
+    }
+
+    compressed = out.data();
+
+    if (!details->mapping) {
+      details_t::nodes_t().swap(details->nodes);
+      root = nullptr;
+    }
+  }
+
+  void mbvh_t::replicate(const mbvh_t& other) {
+    reset();
+
+    if (other.root) {
+      details->nodes.assign(other.root, other.root + other.num_nodes);
+      root = details->nodes.data();
+    }
+
+    if (other.compressed) {
+      details->compressed.assign(other.compressed, other.compressed + other.num_nodes);
+      compressed = details->compressed.data();
+    }
+
+    details->triangles.assign(other.triangles, other.triangles + other.num_triangles);
+    triangles = details->triangles.data();
+
+    num_nodes     = other.num_nodes;
+    num_triangles = other.num_triangles;
+
+    depth = other.depth;
+  }
+
   mbvh_t::builder_t* mbvh_t::builder() {
     return new accel::builder_t(this);
   }
@@ -105,6 +358,9 @@ namespace accel {
     if (root) {
       return root->get_bounds();
     }
+    if (compressed) {
+      return compressed->get_bounds();
+    }
     return Imath::Box3f();
   }
 }
@@ -5,6 +5,8 @@
 #include "bvh/builder.hpp"
 #include "math/simd.hpp"
 
+#include <string>
+
 namespace accel {
 
   namespace triangle {
@@ -30,6 +32,12 @@ namespace accel {
     mbvh::node_t<width>* root;
     // the number of nodes in the tree
     uint32_t num_nodes;
+    // the number of inner nodes on the longest path from the root
+    // to a leaf
+    uint32_t depth;
+    // the same tree, with quantized child bounds. if this is set, the
+    // full precision nodes might have been released
+    mbvh::compressed_node_t<width>* compressed;
     // the optimized triangle data structures in the tree. nodes point into this
     // array, if they are leaf nodes
     triangle_t* triangles;
@@ -44,6 +52,21 @@ namespace accel {
 
     builder_t* builder();
 
+    /** map a tree stored with 'store' into memory. returns false, if
+     * there is no valid tree for the given key at 'path' */
+    bool load(const std::string& path, uint64_t key);
+
+    /** write the tree to disk, so it can be mapped with 'load' later */
+    bool store(const std::string& path, uint64_t key) const;
+
+    /** convert the tree to compressed nodes, and release the full
+     * precision nodes, unless they are mapped from a cache */
+    void compress();
+
+    /** copy another tree into memory owned by this one. pages of the
+     * copy get placed on the numa node of the calling thread */
+    void replicate(const mbvh_t& other);
+
     // the bounds of the mesh data in this accelerator
     Imath::Box3f bounds() const;
   };
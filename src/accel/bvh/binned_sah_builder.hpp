@@ -2,6 +2,7 @@
 
 #include "builder.hpp"
 #include "node.hpp"
+#include "jobs/pool.hpp"
 #include "math/aabb.hpp"
 #include "math/simd.hpp"
 
@@ -10,19 +11,57 @@
 
 #include <algorithm>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <tuple>
 #include <vector>
 
 namespace bvh {
   static const uint8_t MAX_PRIMS_IN_NODE = SIMD_WIDTH;
   static const uint8_t NUM_SPLIT_BINS    = 12;
+  static const uint8_t NUM_SPATIAL_BINS  = 16;
+
+  // spatial splits are only considered if the children of the best object
+  // split overlap by more than this, relative to the area of the scene
+  static const float SPATIAL_SPLIT_ALPHA = 1e-5f;
+
+  // nodes with more primitives than this get binned, and bounded in parallel
+  static const uint32_t PARALLEL_BINNING_THRESHOLD = 64 * 1024;
+  // sub trees with more primitives than this get built as separate tasks
+  static const uint32_t PARALLEL_BUILD_THRESHOLD = 4 * 1024;
+
+  /* Settings for the construction of a tree */
+  struct build_options_t {
+    // number of threads used to build the tree
+    uint32_t threads;
+    // allow splitting primitives between child nodes (SBVH)
+    bool spatial_splits;
+
+    inline build_options_t()
+      : threads(1)
+      , spatial_splits(false)
+    {}
+  };
+
+  /* primitive lists created by spatial splits, owned by the node that
+   * did the split */
+  typedef std::vector<std::unique_ptr<std::vector<primitive_t>>> references_t;
+
+  /* state shared by all nodes of a build */
+  struct context_t {
+    const build_options_t& options;
+    // pool to run parallel parts of the build on, if any
+    job::pool_t* pool;
+    // surface area of the root node
+    float root_area;
+  };
 
   /**
    * Build information about a subset of the primitives in the scene
    */
   struct geometry_t {
     // information relevant for the build, about the primtivies in the scene
-    std::vector<primitive_t>& primitives;
+    std::vector<primitive_t>* primitives;
     // indices into the primitives vector
     uint32_t start, end;
     // the bounding volume for this subset of the primitives in the scene
@@ -37,13 +76,26 @@ namespace bvh {
 
     inline geometry_t(
       std::vector<primitive_t>& primitives
-      , uint32_t start
-      , uint32_t end)
-    : primitives(primitives), start(start), end(end)
+    , uint32_t start
+    , uint32_t end
+    , job::pool_t* pool = nullptr)
+    : primitives(&primitives), start(start), end(end)
     {
-      for (auto i=start; i<end; ++i) {
-      	bounds.extendBy(primitives[i].bounds);
-      	centroid_bounds.extendBy(primitives[i].centroid);
+      if (pool && count() > PARALLEL_BINNING_THRESHOLD) {
+        std::mutex m;
+
+        pool->parallel_for(start, end, PARALLEL_BINNING_THRESHOLD / 4,
+          [&](uint32_t from, uint32_t to) {
+            Imath::Box3f b, c;
+            extend(from, to, b, c);
+
+            std::lock_guard<std::mutex> lock(m);
+            bounds.extendBy(b);
+            centroid_bounds.extendBy(c);
+          });
+      }
+      else {
+        extend(start, end, bounds, centroid_bounds);
       }
     }
 
@@ -61,16 +113,29 @@ namespace bvh {
     }
 
     inline const primitive_t& primitive(uint32_t i) const {
-      return primitives[start+i];
+      return (*primitives)[start+i];
+    }
+
+    inline void extend(
+      uint32_t from
+    , uint32_t to
+    , Imath::Box3f& b
+    , Imath::Box3f& c) const
+    {
+      for (auto i=from; i<to; ++i) {
+        b.extendBy((*primitives)[i].bounds);
+        c.extendBy((*primitives)[i].centroid);
+      }
     }
 
     template<typename F>
-    inline void partition(const F& f, geometry_t& l, geometry_t& r) {
-      auto p   = std::partition(&primitives[start], &primitives[end-1]+1, f);
-      auto mid = (uint32_t) (p - &primitives[0]);
+    inline void partition(const F& f, geometry_t& l, geometry_t& r, job::pool_t* pool) {
+      auto& p   = *primitives;
+      auto  it  = std::partition(&p[start], &p[end-1]+1, f);
+      auto  mid = (uint32_t) (it - &p[0]);
 
-      l = {primitives, start, mid};
-      r = {primitives, mid, end};
+      l = {p, start, mid, pool};
+      r = {p, mid, end, pool};
     }
   };
 
@@ -78,9 +143,15 @@ namespace bvh {
     uint32_t axis;
     uint32_t bin;
     float    cost;
+    // split the primitives at a plane, rather than sorting them by centroid
+    bool     spatial;
+    // position of the split plane, for spatial splits
+    float    position;
+    // bounds of the resulting child nodes
+    Imath::Box3f left, right;
 
     inline split_t(uint32_t axis, uint32_t bin, float cost)
-    : axis(axis), bin(bin), cost(cost)
+    : axis(axis), bin(bin), cost(cost), spatial(false), position(0.0f)
     {}
   };
 
@@ -96,6 +167,11 @@ namespace bvh {
       bounds.extendBy(p.bounds);
       count++;
     }
+
+    inline void add(const bin_t& b) {
+      bounds.extendBy(b.bounds);
+      count += b.count;
+    }
   };
 
   template<int N>
@@ -110,10 +186,16 @@ namespace bvh {
       bins[find(bounds, p, axis)].add(p);
     }
 
+    inline void add(const bins_t& other) {
+      for (auto i=0; i<N; ++i) {
+        bins[i].add(other.bins[i]);
+      }
+    }
+
     static inline Imath::V3f offset(const Imath::Box3f& l, const Imath::V3f& r) {
       auto o = r - l.min;
-      if (l.max.x > l.min.x) { o.x /= (l.max.x - l.min.x); } 
-      if (l.max.y > l.min.y) { o.y /= (l.max.y - l.min.y); } 
+      if (l.max.x > l.min.x) { o.x /= (l.max.x - l.min.x); }
+      if (l.max.y > l.min.y) { o.y /= (l.max.y - l.min.y); }
       if (l.max.z > l.min.z) { o.z /= (l.max.z - l.min.z); }
       return o;
     }
@@ -124,6 +206,60 @@ namespace bvh {
     }
   };
 
+  /* the bins for all three axes of a node */
+  typedef bins_t<NUM_SPLIT_BINS> axis_bins_t[3];
+
+  /* bins for spatial splits. primitives get clipped against the bins
+   * they overlap, and only their entry and exit points get counted */
+  struct spatial_bin_t {
+    uint32_t     enter;
+    uint32_t     exit;
+    Imath::Box3f bounds;
+
+    inline spatial_bin_t()
+    : enter(0), exit(0)
+    {}
+
+    inline void add(const spatial_bin_t& b) {
+      bounds.extendBy(b.bounds);
+      enter += b.enter;
+      exit  += b.exit;
+    }
+  };
+
+  struct spatial_bins_t {
+    spatial_bin_t bins[3][NUM_SPATIAL_BINS];
+
+    inline void add(const spatial_bins_t& other) {
+      for (auto axis=0; axis<3; ++axis) {
+        for (auto i=0; i<NUM_SPATIAL_BINS; ++i) {
+          bins[axis][i].add(other.bins[axis][i]);
+        }
+      }
+    }
+
+    static inline uint32_t find(const Imath::Box3f& bounds, float x, uint8_t axis) {
+      const auto extent = bounds.max[axis] - bounds.min[axis];
+      const auto off    = (x - bounds.min[axis]) / extent;
+      return std::max(0, std::min((int) (NUM_SPATIAL_BINS * off), NUM_SPATIAL_BINS-1));
+    }
+
+    static inline float plane(const Imath::Box3f& bounds, uint32_t i, uint8_t axis) {
+      const auto extent = bounds.max[axis] - bounds.min[axis];
+      return bounds.min[axis] + extent * ((float) i / NUM_SPATIAL_BINS);
+    }
+  };
+
+  template<typename Things>
+  inline Imath::Box3f clip(
+    const Things& things
+  , const primitive_t& p
+  , const Imath::Box3f& box)
+  {
+    const auto& thing = things[p.index];
+    return aabb::clip(thing.a(), thing.b(), thing.c(), box);
+  }
+
   struct node_t {
     geometry_t primitives; // the  primitives in this node
   };
@@ -140,143 +276,466 @@ namespace bvh {
     return g.count();
   }
 
-  split_t find(const geometry_t& geometry) {
+  inline void bin(const geometry_t& g, uint32_t from, uint32_t to, axis_bins_t& bins) {
+    for (auto i=from; i<to; ++i) {
+      const auto& p = g.primitive(i);
+      for (auto axis=0; axis<3; ++axis) {
+        bins[axis].add(g.centroid_bounds, p, axis);
+      }
+    }
+  }
+
+  /* sort all primitives into bins. large nodes are split into chunks
+   * which get binned in parallel and merged afterwards */
+  inline void bin(const geometry_t& g, axis_bins_t& bins, job::pool_t* pool) {
+    if (!pool || g.count() <= PARALLEL_BINNING_THRESHOLD) {
+      bin(g, 0, g.count(), bins);
+      return;
+    }
+
+    std::mutex m;
+
+    pool->parallel_for(0, g.count(), PARALLEL_BINNING_THRESHOLD / 4,
+      [&](uint32_t from, uint32_t to) {
+        axis_bins_t local;
+        bin(g, from, to, local);
+
+        std::lock_guard<std::mutex> lock(m);
+        for (auto axis=0; axis<3; ++axis) {
+          bins[axis].add(local[axis]);
+        }
+      });
+  }
+
+  inline split_t find(const geometry_t& geometry, job::pool_t* pool = nullptr) {
     auto best_axis = 0;
     auto best_bin  = 0;
     auto best_cost = std::numeric_limits<float_t>::max();
+    Imath::Box3f best_left, best_right;
+
+    axis_bins_t all;
+    bin(geometry, all, pool);
 
     for (auto axis=0; axis<3; ++axis) {
-      bins_t<NUM_SPLIT_BINS> bins;
+      const auto& bins = all[axis];
 
       if (aabb::is_empty_on(geometry.centroid_bounds, axis)) {
-       continue;
-     }
-
-     for (auto i=0; i<geometry.count(); ++i) {
-       bins.add(geometry.centroid_bounds, geometry.primitive(i), axis);
-     }
-
-     auto split_cost = std::numeric_limits<float_t>::max();
-     auto split_bin  = 0;
-
-     for (auto i=0; i<NUM_SPLIT_BINS-1; ++i) {
-       Imath::Box3f a, b;
-       auto left = 0; auto right = 0;
-       for (auto j=0; j<=i; ++j) {
-         a.extendBy(bins[j].bounds);
-         left += bins[j].count;
-       }
-
-       for (auto j=i+1; j<NUM_SPLIT_BINS; ++j) {
-         b.extendBy(bins[j].bounds);
-         right += bins[j].count;
-       }
-
-       auto cost = (left * aabb::area(a) + right * aabb::area(b)) / aabb::area(geometry.bounds);
-       if (cost < split_cost) {
-         split_cost = cost;
-         split_bin = i;
-       }
-     }
-
-     if (split_cost < best_cost) {
-       best_axis = axis;
-       best_cost = split_cost;
-       best_bin  = split_bin;
-     }
-   }
-   return split_t(best_axis, best_bin, best_cost);
- }
-
- void split(const split_t& split, geometry_t& parent, geometry_t& l, geometry_t& r) {
-  parent.partition([&](const primitive_t& p) {
-   auto bin = bins_t<NUM_SPLIT_BINS>::find(parent.centroid_bounds, p, split.axis);
-   return bin <= split.bin; 
- }, l, r);
-}
+        continue;
+      }
 
-int32_t largest_node(const geometry_t* node, uint32_t n) {
-  int32_t out = -1;
-  float   a   = std::numeric_limits<float>::max(); 
-  for (auto i=0; i<n; ++i) {
-    if (node[i].count() < MAX_PRIMS_IN_NODE) {
-     continue;
-   }
-
-   auto node_area = aabb::area(node[i].bounds);
-   if (node_area < a) {
-     out = i;
-     a   = node_area;
-   }
- }
- return out;
-}
+      auto split_cost = std::numeric_limits<float_t>::max();
+      auto split_bin  = 0;
+      Imath::Box3f split_left, split_right;
+
+      for (auto i=0; i<NUM_SPLIT_BINS-1; ++i) {
+        Imath::Box3f a, b;
+        auto left = 0; auto right = 0;
+        for (auto j=0; j<=i; ++j) {
+          a.extendBy(bins[j].bounds);
+          left += bins[j].count;
+        }
+
+        for (auto j=i+1; j<NUM_SPLIT_BINS; ++j) {
+          b.extendBy(bins[j].bounds);
+          right += bins[j].count;
+        }
+
+        auto cost = (left * aabb::area(a) + right * aabb::area(b)) / aabb::area(geometry.bounds);
+        if (cost < split_cost) {
+          split_cost  = cost;
+          split_bin   = i;
+          split_left  = a;
+          split_right = b;
+        }
+      }
 
-  template<typename Things, typename Builder>
-uint32_t from(geometry_t& geometry, const Things& things, Builder& bvh) {
-  auto n = geometry.count();
-  auto s = find(geometry);
+      if (split_cost < best_cost) {
+        best_axis  = axis;
+        best_cost  = split_cost;
+        best_bin   = split_bin;
+        best_left  = split_left;
+        best_right = split_right;
+      }
+    }
+
+    split_t out(best_axis, best_bin, best_cost);
+    out.left  = best_left;
+    out.right = best_right;
+    return out;
+  }
+
+  template<typename Things>
+  inline void bin(
+    const geometry_t& g
+  , const Things& things
+  , uint32_t from
+  , uint32_t to
+  , spatial_bins_t& bins)
+  {
+    for (auto i=from; i<to; ++i) {
+      const auto& p = g.primitive(i);
+
+      for (auto axis=0; axis<3; ++axis) {
+        if (g.bounds.max[axis] <= g.bounds.min[axis]) {
+          continue;
+        }
+
+        auto& axis_bins = bins.bins[axis];
+
+        const auto first = spatial_bins_t::find(g.bounds, p.bounds.min[axis], axis);
+        const auto last  = spatial_bins_t::find(g.bounds, p.bounds.max[axis], axis);
+
+        if (first == last) {
+          axis_bins[first].bounds.extendBy(p.bounds);
+        }
+        else {
+          for (auto j=first; j<=last; ++j) {
+            auto box = p.bounds;
+            box.min[axis] = std::max(box.min[axis], spatial_bins_t::plane(g.bounds, j, axis));
+            box.max[axis] = std::min(box.max[axis], spatial_bins_t::plane(g.bounds, j+1, axis));
+            axis_bins[j].bounds.extendBy(clip(things, p, box));
+          }
+        }
+
+        axis_bins[first].enter++;
+        axis_bins[last].exit++;
+      }
+    }
+  }
+
+  /* find the best split plane for a node, where primitives crossing the
+   * plane are referenced from both children (Stich et al., 2009) */
+  template<typename Things>
+  inline split_t find_spatial(
+    const geometry_t& geometry
+  , const Things& things
+  , job::pool_t* pool)
+  {
+    spatial_bins_t all;
+
+    if (!pool || geometry.count() <= PARALLEL_BINNING_THRESHOLD) {
+      bin(geometry, things, 0, geometry.count(), all);
+    }
+    else {
+      std::mutex m;
+
+      pool->parallel_for(0, geometry.count(), PARALLEL_BINNING_THRESHOLD / 4,
+        [&](uint32_t from, uint32_t to) {
+          spatial_bins_t local;
+          bin(geometry, things, from, to, local);
+
+          std::lock_guard<std::mutex> lock(m);
+          all.add(local);
+        });
+    }
+
+    split_t best(0, 0, std::numeric_limits<float_t>::max());
+    best.spatial = true;
+
+    const auto n = geometry.count();
+
+    for (auto axis=0; axis<3; ++axis) {
+      if (geometry.bounds.max[axis] <= geometry.bounds.min[axis]) {
+        continue;
+      }
 
-  if (too_small_to_split(geometry) || leaf_cost(s, geometry) <= 1.0f + s.cost) {
-    return 0;
+      const auto& bins = all.bins[axis];
+
+      for (auto i=0; i<NUM_SPATIAL_BINS-1; ++i) {
+        Imath::Box3f a, b;
+        auto left = 0u; auto right = 0u;
+        for (auto j=0; j<=i; ++j) {
+          a.extendBy(bins[j].bounds);
+          left += bins[j].enter;
+        }
+
+        for (auto j=i+1; j<NUM_SPATIAL_BINS; ++j) {
+          b.extendBy(bins[j].bounds);
+          right += bins[j].exit;
+        }
+
+        // both children need to get smaller, otherwise the build might
+        // not terminate
+        if (left == 0 || right == 0 || left >= n || right >= n) {
+          continue;
+        }
+
+        auto cost = (left * aabb::area(a) + right * aabb::area(b)) / aabb::area(geometry.bounds);
+        if (cost < best.cost) {
+          best.axis     = axis;
+          best.bin      = i;
+          best.cost     = cost;
+          best.position = spatial_bins_t::plane(geometry.bounds, i+1, axis);
+          best.left     = a;
+          best.right    = b;
+        }
+      }
+    }
+
+    return best;
+  }
+
+  /* find the best split for a node. spatial splits are only tried, if the
+   * children of the best object split overlap noticeably */
+  template<typename Things>
+  inline split_t find(
+    const geometry_t& geometry
+  , const Things& things
+  , const context_t& ctx)
+  {
+    auto s = find(geometry, ctx.pool);
+
+    if (!ctx.options.spatial_splits) {
+      return s;
+    }
+
+    const auto overlap = s.left.isEmpty() || s.right.isEmpty()
+      ? Imath::Box3f()
+      : Imath::Box3f(
+          Imath::V3f(
+            std::max(s.left.min.x, s.right.min.x),
+            std::max(s.left.min.y, s.right.min.y),
+            std::max(s.left.min.z, s.right.min.z)),
+          Imath::V3f(
+            std::min(s.left.max.x, s.right.max.x),
+            std::min(s.left.max.y, s.right.max.y),
+            std::min(s.left.max.z, s.right.max.z)));
+
+    // a failed object split (all centroids in one place) always qualifies
+    const auto failed = !(s.cost < std::numeric_limits<float_t>::max());
+
+    if (failed || (!overlap.isEmpty() && aabb::area(overlap) > SPATIAL_SPLIT_ALPHA * ctx.root_area)) {
+      auto spatial = find_spatial(geometry, things, ctx.pool);
+      if (spatial.cost < s.cost) {
+        return spatial;
+      }
+    }
+
+    return s;
+  }
+
+  inline void split(
+    const split_t& split
+  , geometry_t& parent
+  , geometry_t& l
+  , geometry_t& r
+  , job::pool_t* pool = nullptr)
+  {
+    parent.partition([&](const primitive_t& p) {
+      auto bin = bins_t<NUM_SPLIT_BINS>::find(parent.centroid_bounds, p, split.axis);
+      return bin <= split.bin;
+    }, l, r, pool);
+  }
+
+  /* split a node at a plane. primitives crossing the plane get clipped,
+   * and end up in both children. the children get a new primitive list,
+   * which is owned by 'references' */
+  template<typename Things>
+  inline void split(
+    const split_t& split
+  , geometry_t& parent
+  , geometry_t& l
+  , geometry_t& r
+  , const Things& things
+  , references_t& references)
+  {
+    std::vector<primitive_t> left, right;
+    left.reserve(parent.count());
+    right.reserve(parent.count());
+
+    const auto axis = split.axis;
+
+    for (auto i=0; i<parent.count(); ++i) {
+      const auto& p = parent.primitive(i);
+
+      if (p.bounds.max[axis] <= split.position) {
+        left.push_back(p);
+      }
+      else if (p.bounds.min[axis] >= split.position) {
+        right.push_back(p);
+      }
+      else {
+        auto lbox = p.bounds; lbox.max[axis] = split.position;
+        auto rbox = p.bounds; rbox.min[axis] = split.position;
+
+        lbox = clip(things, p, lbox);
+        rbox = clip(things, p, rbox);
+
+        if (!lbox.isEmpty()) {
+          left.emplace_back(p.index, lbox);
+        }
+
+        if (!rbox.isEmpty()) {
+          right.emplace_back(p.index, rbox);
+        }
+      }
+    }
+
+    auto* primitives = new std::vector<primitive_t>();
+    references.emplace_back(primitives);
+
+    primitives->reserve(left.size() + right.size());
+    primitives->insert(primitives->end(), left.begin(), left.end());
+    primitives->insert(primitives->end(), right.begin(), right.end());
+
+    l = {*primitives, 0, (uint32_t) left.size()};
+    r = {*primitives, (uint32_t) left.size(), (uint32_t) primitives->size()};
   }
 
-  auto num_children = 2;
-  geometry_t children[8] = { [0 ... 7] = { geometry } };
+  template<typename Things>
+  inline void split(
+    const split_t& s
+  , geometry_t& parent
+  , geometry_t& l
+  , geometry_t& r
+  , const Things& things
+  , references_t& references
+  , const context_t& ctx)
+  {
+    if (s.spatial) {
+      split(s, parent, l, r, things, references);
+    }
+    else {
+      split(s, parent, l, r, ctx.pool);
+    }
+  }
+
+  inline int32_t largest_node(const geometry_t* node, uint32_t n) {
+    int32_t out = -1;
+    float   a   = std::numeric_limits<float>::max();
+    for (auto i=0; i<n; ++i) {
+      if (node[i].count() < MAX_PRIMS_IN_NODE) {
+        continue;
+      }
+
+      auto node_area = aabb::area(node[i].bounds);
+      if (node_area < a) {
+        out = i;
+        a   = node_area;
+      }
+    }
+    return out;
+  }
 
-  split(s, geometry, children[0], children[1]);
+  /* recursively build a tree over a subset of the primitives. child nodes
+   * that are large enough get built as separate tasks on the pool, so
+   * sub trees are constructed in parallel */
+  template<typename Things, typename Node, typename Primitive>
+  uint32_t from(
+    geometry_t& geometry
+  , const Things& things
+  , builder_t<Node, Primitive>& bvh
+  , const context_t& ctx)
+  {
+    auto s = find(geometry, things, ctx);
+
+    if (too_small_to_split(geometry) || leaf_cost(s, geometry) <= 1.0f + s.cost) {
+      return 0;
+    }
 
-  while (num_children < 8) {
-    auto split_child = largest_node(children, num_children);
-    if (split_child == -1) {
-     break;
-   }
-   auto s = find(children[split_child]);
+    auto num_children = 2;
+    geometry_t children[8] = {
+      geometry, geometry, geometry, geometry,
+      geometry, geometry, geometry, geometry
+    };
+
+    // primitive lists created by spatial splits of this node
+    references_t references;
+
+    split(s, geometry, children[0], children[1], things, references, ctx);
+
+    while (num_children < 8) {
+      auto split_child = largest_node(children, num_children);
+      if (split_child == -1) {
+        break;
+      }
+      auto s = find(children[split_child], things, ctx);
       // check sha heuristic?
-   geometry_t tmp(geometry);
-   split(s, children[split_child], tmp, children[num_children]);
-   children[split_child] = tmp;
+      geometry_t tmp(geometry);
+      split(s, children[split_child], tmp, children[num_children], things, references, ctx);
+      children[split_child] = tmp;
 
-   ++num_children;
- }
+      ++num_children;
+    }
 
     // make a new node in the BVH
- auto node_index = bvh->make_node();
+    auto node_index = bvh.make_node();
 
- int32_t child_indices[num_children];
- for (int i=0; i<num_children; ++i) {
-  child_indices[i] = from(children[i], things, bvh);
-}
+    int32_t child_indices[8];
+    job::pool_t::group_t group;
 
-auto& node = bvh->resolve(node_index);
-
-for (int i=0; i<num_children; ++i) {
-  node.set_bounds(i, children[i].bounds);
-
-  if (child_indices[i]) {
-   node.set_offset(i, child_indices[i]);
- }
- else {
-   auto index =
-   bvh->add(
-     children[i].start, children[i].end,
-     geometry.primitives,
-     things);
-   node.set_leaf(i, index, children[i].count());
- }
-}
+    for (int i=0; i<num_children; ++i) {
+      auto& child = children[i];
+      auto& index = child_indices[i];
 
-return node_index;
-}
+      if (ctx.pool && child.count() > PARALLEL_BUILD_THRESHOLD) {
+        ctx.pool->spawn(group, [&child, &index, &things, &bvh, &ctx]() {
+          index = from(child, things, bvh, ctx);
+        });
+      }
+      else {
+        index = from(child, things, bvh, ctx);
+      }
+    }
 
-  template<typename Things, typename Builder>
-void from(Builder& bvh, const Things& things) {
-  std::vector<primitive_t> primitives(things.size());
-  for (uint32_t i=0; i<things.size(); ++i) {
-    primitives[i] = { i, things[i].bounds() };
+    if (ctx.pool) {
+      ctx.pool->wait(group);
+    }
+
+    // nodes get assembled locally and committed at once, since other
+    // tasks might be adding nodes to the tree at the same time
+    Node node;
+
+    for (int i=0; i<num_children; ++i) {
+      node.set_bounds(i, children[i].bounds);
+
+      if (child_indices[i]) {
+        node.set_offset(i, child_indices[i]);
+      }
+      else {
+        auto index =
+          bvh.add(
+            children[i].start, children[i].end,
+            *children[i].primitives,
+            things);
+        node.set_leaf(i, index, children[i].count());
+      }
+    }
+
+    bvh.commit(node_index, node);
+
+    return node_index;
   }
 
-  geometry_t geometry(primitives, 0, primitives.size());
-  from(geometry, things, bvh);
-}
+  template<typename Things, typename Builder>
+  void from(
+    Builder& bvh
+  , const Things& things
+  , const build_options_t& options = build_options_t())
+  {
+    std::unique_ptr<job::pool_t> pool;
+    if (options.threads > 1) {
+      pool.reset(new job::pool_t(options.threads));
+    }
+
+    std::vector<primitive_t> primitives(things.size());
+
+    const auto bound = [&](uint32_t from, uint32_t to) {
+      for (auto i=from; i<to; ++i) {
+        primitives[i] = { i, things[i].bounds() };
+      }
+    };
+
+    if (pool) {
+      pool->parallel_for(0, things.size(), PARALLEL_BINNING_THRESHOLD / 4, bound);
+    }
+    else {
+      bound(0, things.size());
+    }
+
+    geometry_t geometry(primitives, 0, primitives.size(), pool.get());
+
+    const context_t ctx = { options, pool.get(), aabb::area(geometry.bounds) };
+    from(geometry, things, *bvh, ctx);
+  }
 }
@@ -25,6 +25,11 @@ namespace bvh {
     {}
   };
 
+  /**
+   * Interface to the storage of a tree under construction. Builders
+   * may call into this from multiple threads at the same time, so
+   * implementations have to be thread safe
+   */
   template<typename Node, typename Primitive>
   struct builder_t {
     typedef std::unique_ptr<builder_t> scoped_t;
@@ -35,6 +40,9 @@ namespace bvh {
 
     virtual Node& resolve(uint32_t n) const = 0;
 
+    /* store the final contents of a node allocated with make_node */
+    virtual void commit(uint32_t n, const Node& node) = 0;
+
     virtual uint32_t add(
       uint32_t begin
     , uint32_t end
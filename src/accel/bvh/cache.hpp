@@ -0,0 +1,84 @@
+#pragma once
+
+#include "binned_sah_builder.hpp"
+#include "node.hpp"
+#include "../triangle.hpp"
+#include "../../triangle.hpp"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace bvh {
+  /* Helpers to store built trees on disk, so that re-rendering the same
+   * geometry can skip the build. Cached trees are identified by a hash
+   * over everything that ends up in the tree: vertex positions, mesh,
+   * material and face ids, build settings, and the memory layout of
+   * nodes and leaves */
+  namespace cache {
+    // bump this, when the file format, or the builder output changes
+    static const uint32_t VERSION = 1;
+
+    /* 64 bit FNV-1a, on 32 bit words */
+    struct hash_t {
+      uint64_t value;
+
+      inline hash_t()
+        : value(0xcbf29ce484222325ull)
+      {}
+
+      inline void add(uint32_t word) {
+        value ^= word;
+        value *= 0x100000001b3ull;
+      }
+
+      inline void add(float f) {
+        uint32_t word;
+        memcpy(&word, &f, sizeof(float));
+        add(word);
+      }
+
+      inline void add(const Imath::V3f& v) {
+        add(v.x); add(v.y); add(v.z);
+      }
+    };
+
+    template<int N>
+    inline uint64_t key(
+      const std::vector<triangle_t>& triangles
+    , const build_options_t& options)
+    {
+      hash_t hash;
+
+      hash.add(VERSION);
+      hash.add((uint32_t) N);
+      hash.add((uint32_t) sizeof(mbvh::node_t<N>));
+      hash.add((uint32_t) sizeof(accel::triangle::moeller_trumbore_t<N>));
+      hash.add((uint32_t) options.spatial_splits);
+      hash.add((uint32_t) triangles.size());
+
+      for (const auto& triangle : triangles) {
+        hash.add(triangle.a());
+        hash.add(triangle.b());
+        hash.add(triangle.c());
+        hash.add(triangle.meshid());
+        hash.add(triangle.matid());
+        hash.add(triangle.face);
+      }
+
+      return hash.value;
+    }
+
+    /* the file a tree with the given key gets cached in */
+    inline std::string path(const std::string& directory, uint64_t key) {
+      std::stringstream out;
+      out
+        << directory << "/"
+        << std::hex << std::setw(16) << std::setfill('0') << key
+        << ".bvh";
+      return out.str();
+    }
+  }
+}
@@ -3,6 +3,8 @@
 #include <ImathBox.h>
 #include <ImathVec.h>
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 #include <string.h>
@@ -65,5 +67,122 @@ namespace mbvh {
       offset[i] = index;
       num[i]    = count;
     }
+
+    inline bool is_leaf(uint32_t i) const {
+      return flags[i] & 0x1;
+    }
+
+    inline bool is_empty(uint32_t i) const {
+      return bounds[i] > bounds[i + 3*N];
+    }
+  };
+
+  /* A node with the bounds of its children quantized to 8 bit, relative
+   * to the bounds of the node itself. Quantized bounds are rounded
+   * outwards, so they are conservative. Leaf flags are packed into a
+   * bit mask. For N = 8 this fits a node into two cache lines, instead
+   * of five for node_t */
+  template<int N>
+  struct alignas(64) compressed_node_t {
+    // the lower corner of the node bounds, and the size of one
+    // quantization step, per axis
+    float origin[3];
+    float scale[3];
+    // quantized child bounds, laid out like the bounds in node_t
+    uint8_t bounds[2*N*3];
+    // offset to child nodes, or into the list of triangles
+    uint32_t offset[N];
+    // number of primitives stored at a node, if it is a leaf node
+    uint8_t num[N];
+    // bit i is set, if child i is a leaf
+    uint8_t leaves;
+
+    compressed_node_t()
+      : leaves(0)
+    {
+      for (int i=0; i<3; ++i) {
+        origin[i] = 0.0f;
+        scale[i]  = 1.0f;
+      }
+
+      // empty children decode to inverted boxes, that never get hit
+      memset(bounds, 0xff, N*3);
+      memset(bounds + N*3, 0, N*3);
+      memset(offset, 0, N*sizeof(uint32_t));
+      memset(num, 0, N*sizeof(uint8_t));
+    }
+
+    compressed_node_t(const node_t<N>& node)
+      : compressed_node_t()
+    {
+      const auto box = node.get_bounds();
+
+      if (!box.isEmpty()) {
+        for (int axis=0; axis<3; ++axis) {
+          const auto extent = box.max[axis] - box.min[axis];
+
+          origin[axis] = box.min[axis];
+          scale[axis]  = extent > 0.0f ? extent / 255.0f : 1.0f;
+
+          // make sure the quantization grid covers the whole node
+          while (dequantize(255, axis) < box.max[axis]) {
+            scale[axis] = std::nextafter(scale[axis], std::numeric_limits<float>::max());
+          }
+        }
+      }
+
+      for (int i=0; i<N; ++i) {
+        offset[i] = node.offset[i];
+        num[i]    = node.num[i];
+
+        if (node.is_leaf(i)) {
+          leaves |= (1 << i);
+        }
+
+        if (node.is_empty(i)) {
+          continue;
+        }
+
+        for (int axis=0; axis<3; ++axis) {
+          bounds[i + axis*N]     = quantize_min(node.bounds[i + axis*N], axis);
+          bounds[i + (axis+3)*N] = quantize_max(node.bounds[i + (axis+3)*N], axis);
+        }
+      }
+    }
+
+    inline bool is_leaf(uint32_t i) const {
+      return leaves & (1 << i);
+    }
+
+    inline Imath::Box3f get_bounds() const {
+      return Imath::Box3f(
+        Imath::V3f(origin[0], origin[1], origin[2]),
+        Imath::V3f(dequantize(255, 0), dequantize(255, 1), dequantize(255, 2)));
+    }
+
+  private:
+    // matches the fused multiply add used to decode bounds in the
+    // traversal, so rounding is the same in both places
+    inline float dequantize(uint8_t q, int axis) const {
+      return std::fma((float) q, scale[axis], origin[axis]);
+    }
+
+    inline uint8_t quantize_min(float x, int axis) const {
+      auto q = (int) std::floor((x - origin[axis]) / scale[axis]);
+      q = std::max(0, std::min(q, 255));
+      while (q > 0 && dequantize(q, axis) > x) {
+        --q;
+      }
+      return q;
+    }
+
+    inline uint8_t quantize_max(float x, int axis) const {
+      auto q = (int) std::ceil((x - origin[axis]) / scale[axis]);
+      q = std::max(0, std::min(q, 255));
+      while (q < 255 && dequantize(q, axis) < x) {
+        ++q;
+      }
+      return q;
+    }
   };
 }
@@ -0,0 +1,421 @@
+#pragma once
+
+#include "math/aabb.hpp"
+
+#include <ImathBox.h>
+#include <ImathVec.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace accel {
+  /**
+   * A bounding volume hierarchy over light sources, used to pick lights
+   * with a probability that approximates their contribution at a shading
+   * point. Nodes bound the positions, emission directions, and the total
+   * power of the lights below them. Area lights emit on both sides, so
+   * directions are bounded with two sided cones
+   *
+   * See: Conty Estevez, Kulla, "Importance Sampling of Many Lights with
+   * Adaptive Tree Splitting", HPG 2018
+   */
+  struct light_tree_t {
+    static const uint32_t NUM_SPLIT_BINS = 12;
+
+    /* bounds a set of directions, and their opposites, with the
+     * directions inside an angle around an axis */
+    struct cone_t {
+      Imath::V3f axis;
+      float cos_theta;
+
+      inline float theta() const {
+        return std::acos(std::max(-1.0f, std::min(cos_theta, 1.0f)));
+      }
+
+      /* the smallest cone containing two cones */
+      static inline cone_t merge(const cone_t& a, cone_t b) {
+        static const float half_pi = M_PI * 0.5f;
+
+        if (a.axis.dot(b.axis) < 0.0f) {
+          b.axis = -b.axis;
+        }
+
+        const auto theta_a = a.theta();
+        const auto theta_b = b.theta();
+
+        if (theta_a < theta_b) {
+          return merge(b, a);
+        }
+
+        const auto theta_d = std::acos(std::min(a.axis.dot(b.axis), 1.0f));
+
+        if (std::min(theta_d + theta_b, (float) M_PI) <= theta_a) {
+          return a;
+        }
+
+        // two sided cones wider than this contain all directions
+        const auto theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+        if (theta_o >= half_pi) {
+          return { a.axis, 0.0f };
+        }
+
+        // rotate the axis of a towards the axis of b
+        const auto ortho = b.axis - a.axis * a.axis.dot(b.axis);
+        const auto len   = ortho.length();
+
+        if (len < 1e-6f) {
+          return { a.axis, std::cos(theta_o) };
+        }
+
+        const auto theta_r = theta_o - theta_a;
+        const auto axis =
+          a.axis * std::cos(theta_r) + ortho * (std::sin(theta_r) / len);
+
+        return { axis.normalized(), std::cos(theta_o) };
+      }
+
+      /* measure of the solid angle a cone emits into, for emitters with
+       * a cosine falloff */
+      inline float measure() const {
+        static const float half_pi = M_PI * 0.5f;
+
+        const auto theta_o = theta();
+        const auto theta_w = std::min(theta_o + half_pi, (float) M_PI);
+        const auto sin_o   = std::sin(theta_o);
+        const auto cos_o   = std::cos(theta_o);
+
+        return
+          2.0f * M_PI * (1.0f - cos_o) +
+          half_pi * (
+            2.0f * theta_w * sin_o
+          - std::cos(theta_o - 2.0f * theta_w)
+          - 2.0f * theta_o * sin_o
+          + cos_o);
+      }
+    };
+
+    /* a light as seen by the tree */
+    struct item_t {
+      Imath::Box3f bounds;
+      cone_t cone;
+      float power;
+    };
+
+    struct node_t {
+      Imath::Box3f bounds;
+      cone_t cone;
+      float power;
+      // index of the light for leaves, and of the second child
+      // otherwise. the first child always follows its parent
+      uint32_t offset;
+      uint32_t leaf;
+    };
+
+    std::vector<node_t>   nodes;
+    // parent of every node, to compute the probability of a light
+    std::vector<uint32_t> parents;
+    // leaf node of every light
+    std::vector<uint32_t> leaves;
+
+    inline void build(const std::vector<item_t>& items) {
+      nodes.clear();
+      parents.clear();
+      leaves.assign(items.size(), 0);
+
+      if (items.empty()) {
+        return;
+      }
+
+      std::vector<uint32_t> indices(items.size());
+      for (auto i=0u; i<items.size(); ++i) {
+        indices[i] = i;
+      }
+
+      build(items, indices.data(), indices.data() + indices.size(), 0);
+    }
+
+    inline bool empty() const {
+      return nodes.empty();
+    }
+
+    /* cosine of the angle a - b, with a - b clamped to zero. angles
+     * are given by their sines and cosines */
+    static inline float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+      return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static inline float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+      return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+    }
+
+    static inline float sin_from_cos(float c) {
+      return std::sqrt(std::max(0.0f, 1.0f - c * c));
+    }
+
+    /* an upper bound of the light a node can contribute at a point */
+    inline float importance(
+      const node_t& node
+    , const Imath::V3f& p
+    , const Imath::V3f& n) const
+    {
+      const auto center = (node.bounds.min + node.bounds.max) * 0.5f;
+      const auto r2     = (node.bounds.max - node.bounds.min).length2() * 0.25f;
+
+      auto wi = center - p;
+      const auto d2 = wi.length2();
+
+      // points inside the bounds can see the node from any direction
+      if (d2 <= r2) {
+        return node.power / std::max(r2, std::numeric_limits<float>::min());
+      }
+
+      wi *= 1.0f / std::sqrt(d2);
+
+      // the angle the bounds subtend as seen from the point
+      const auto sin_u = std::sqrt(r2 / d2);
+      const auto cos_u = sin_from_cos(sin_u);
+
+      // angle between the emitter, and the direction to the point,
+      // reduced by the spread of the emitters, and the bounds
+      const auto cos_w = std::min(std::fabs(node.cone.axis.dot(wi)), 1.0f);
+      const auto sin_w = sin_from_cos(cos_w);
+      const auto cos_o = node.cone.cos_theta;
+      const auto sin_o = sin_from_cos(cos_o);
+
+      const auto cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, cos_o);
+      const auto sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, cos_o);
+      const auto cos_e = cos_sub_clamped(sin_x, cos_x, sin_u, cos_u);
+
+      if (cos_e <= 0.0f) {
+        return 0.0f;
+      }
+
+      // angle between the receiver, and the direction to the node
+      const auto cos_n = std::max(-1.0f, std::min(n.dot(wi), 1.0f));
+      const auto cos_i = cos_sub_clamped(sin_from_cos(cos_n), cos_n, sin_u, cos_u);
+
+      if (cos_i <= 0.0f) {
+        return 0.0f;
+      }
+
+      return node.power * cos_e * cos_i / d2;
+    }
+
+    /* pick a light for a shading point. returns false, if no light can
+     * contribute to the point */
+    inline bool sample(
+      const Imath::V3f& p
+    , const Imath::V3f& n
+    , float u
+    , uint32_t& light
+    , float& pdf) const
+    {
+      if (nodes.empty()) {
+        return false;
+      }
+
+      pdf = 1.0f;
+
+      auto index = 0u;
+      while (!nodes[index].leaf) {
+        const auto left  = index + 1;
+        const auto right = nodes[index].offset;
+
+        const auto il = importance(nodes[left], p, n);
+        const auto ir = importance(nodes[right], p, n);
+
+        if (il + ir <= 0.0f) {
+          return false;
+        }
+
+        const auto pl = il / (il + ir);
+
+        if (u < pl) {
+          u = std::min(u / pl, 1.0f - std::numeric_limits<float>::epsilon());
+          pdf *= pl;
+          index = left;
+        }
+        else {
+          u = std::min((u - pl) / (1.0f - pl), 1.0f - std::numeric_limits<float>::epsilon());
+          pdf *= 1.0f - pl;
+          index = right;
+        }
+      }
+
+      light = nodes[index].offset;
+
+      return true;
+    }
+
+    /* the probability of picking a light at a shading point */
+    inline float pdf(
+      const Imath::V3f& p
+    , const Imath::V3f& n
+    , uint32_t light) const
+    {
+      auto pdf = 1.0f;
+
+      auto index = leaves[light];
+      while (index != 0) {
+        const auto parent = parents[index];
+        const auto left   = parent + 1;
+        const auto right  = nodes[parent].offset;
+
+        const auto il = importance(nodes[left], p, n);
+        const auto ir = importance(nodes[right], p, n);
+
+        if (il + ir <= 0.0f) {
+          return 0.0f;
+        }
+
+        pdf *= (index == left ? il : ir) / (il + ir);
+        index = parent;
+      }
+
+      return pdf;
+    }
+
+  private:
+
+    static inline Imath::V3f centroid(const item_t& item) {
+      return (item.bounds.min + item.bounds.max) * 0.5f;
+    }
+
+    /* surface area orientation heuristic of a set of lights */
+    static inline float cost(const Imath::Box3f& bounds, const cone_t& cone, float power) {
+      return power * std::max(aabb::area(bounds), 1e-12f) * cone.measure();
+    }
+
+    struct bin_t {
+      Imath::Box3f bounds;
+      cone_t cone;
+      float power;
+      uint32_t num;
+
+      inline bin_t()
+        : power(0.0f), num(0)
+      {}
+
+      inline void add(const Imath::Box3f& b, const cone_t& c, float p) {
+        cone = num == 0 ? c : cone_t::merge(cone, c);
+        bounds.extendBy(b);
+        power += p;
+      }
+
+      inline void add(const item_t& item) {
+        add(item.bounds, item.cone, item.power);
+        ++num;
+      }
+
+      inline void add(const bin_t& bin) {
+        if (bin.num > 0) {
+          add(bin.bounds, bin.cone, bin.power);
+          num += bin.num;
+        }
+      }
+    };
+
+    inline uint32_t build(
+      const std::vector<item_t>& items
+    , uint32_t* begin
+    , uint32_t* end
+    , uint32_t parent)
+    {
+      const auto index = (uint32_t) nodes.size();
+
+      bin_t all;
+      Imath::Box3f centroids;
+      for (auto i=begin; i!=end; ++i) {
+        all.add(items[*i]);
+        centroids.extendBy(centroid(items[*i]));
+      }
+
+      nodes.push_back({ all.bounds, all.cone, all.power, 0, 0 });
+      parents.push_back(parent);
+
+      if (end - begin == 1) {
+        nodes[index].offset = *begin;
+        nodes[index].leaf   = 1;
+        leaves[*begin] = index;
+        return index;
+      }
+
+      const auto extent     = all.bounds.max - all.bounds.min;
+      const auto max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+
+      auto best_cost = std::numeric_limits<float>::max();
+      auto best_axis = -1;
+      auto best_bin  = 0u;
+
+      for (auto axis=0; axis<3; ++axis) {
+        const auto min  = centroids.min[axis];
+        const auto size = centroids.max[axis] - min;
+
+        if (size <= 0.0f) {
+          continue;
+        }
+
+        bin_t bins[NUM_SPLIT_BINS];
+        for (auto i=begin; i!=end; ++i) {
+          const auto b = std::min(
+            (uint32_t) (NUM_SPLIT_BINS * ((centroid(items[*i])[axis] - min) / size))
+          , NUM_SPLIT_BINS - 1);
+          bins[b].add(items[*i]);
+        }
+
+        // regularize, so thin nodes get split along their long side
+        const auto kr = extent[axis] > 0.0f ? max_extent / extent[axis] : 1.0f;
+
+        for (auto split=1u; split<NUM_SPLIT_BINS; ++split) {
+          bin_t left, right;
+          for (auto i=0u; i<split; ++i) {
+            left.add(bins[i]);
+          }
+          for (auto i=split; i<NUM_SPLIT_BINS; ++i) {
+            right.add(bins[i]);
+          }
+
+          if (left.num == 0 || right.num == 0) {
+            continue;
+          }
+
+          const auto c = kr * (
+            cost(left.bounds, left.cone, left.power) +
+            cost(right.bounds, right.cone, right.power));
+
+          if (c < best_cost) {
+            best_cost = c;
+            best_axis = axis;
+            best_bin  = split;
+          }
+        }
+      }
+
+      uint32_t* mid;
+      if (best_axis < 0) {
+        // all lights are in the same spot
+        mid = begin + (end - begin) / 2;
+      }
+      else {
+        const auto min  = centroids.min[best_axis];
+        const auto size = centroids.max[best_axis] - min;
+
+        mid = std::partition(begin, end, [&](uint32_t i) {
+          const auto b = std::min(
+            (uint32_t) (NUM_SPLIT_BINS * ((centroid(items[i])[best_axis] - min) / size))
+          , NUM_SPLIT_BINS - 1);
+          return b < best_bin;
+        });
+      }
+
+      build(items, begin, mid, index);
+      const auto right = build(items, mid, end, index);
+
+      nodes[index].offset = right;
+
+      return index;
+    }
+  };
+}
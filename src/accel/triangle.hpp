@@ -200,6 +200,138 @@ namespace accel {
       	}
       }
 
+      /**
+       * Any hit version of 'iterate_rays', for occlusion queries. Rays
+       * that already hit something are skipped, and a ray is only
+       * marked as hit, without writing surface data */
+      template<typename T>
+      inline void occluded_rays(
+        T* stream
+      , uint32_t* indices
+      , uint32_t num_rays) const
+      {
+        const auto
+          one  = simd::floatv_t(1.0f),
+          zero = simd::floatv_t(0.0f),
+          peps = simd::floatv_t(0.00000001f),
+          meps = simd::floatv_t(-0.00000001f);
+
+        const auto e0 = _e0.stream();
+        const auto e1 = _e1.stream();
+        const auto v0 = _v0.stream();
+
+        // ignore the unused slots in this set of triangles
+        const auto valid = (1 << num) - 1;
+
+        for (auto i=0; i<num_rays; ++i) {
+          const auto index = indices[i];
+
+          if (stream->is_hit(index)) {
+            continue;
+          }
+
+          const auto o  = stream->p.v_at(index);
+          const auto wi = stream->wi.v_at(index);
+
+          const simd::float_t<N> d(stream->d[index]);
+
+          const auto t   = o - v0;
+          const auto p   = wi.cross(e1);
+          const auto det = e0.dot(p);
+          const auto ood = one / det;
+          const auto q   = t.cross(e0);
+
+          const auto us = t.dot(p) * ood;
+          const auto vs = wi.dot(q) * ood;
+          const auto ds = e1.dot(q) * ood;
+
+          const auto xmask = (det > peps) | (det < meps);
+          const auto umask = us >= zero;
+          const auto vmask = (vs >= zero) & ((us + vs) <= one);
+          const auto dmask = (ds >= zero) & (ds < d);
+
+          auto mask = simd::to_mask(vmask & umask & dmask & xmask) & valid;
+
+          if (mask != 0) {
+            __aligned(32) float dists[N];
+            ds.store(dists);
+
+            stream->hit(index, dists[__bscf(mask)]);
+          }
+        }
+      }
+
+      /**
+       * Any hit version of 'iterate_triangles', for occlusion queries.
+       * Stops testing triangles, as soon as all rays are occluded */
+      template<typename Stream>
+      inline void occluded_triangles(
+        Stream* stream
+      , uint32_t* indices
+      , uint32_t num_rays) const
+      {
+        const auto
+          one  = simd::floatv_t(1.0f),
+          zero = simd::floatv_t(0.0f),
+          peps = simd::floatv_t(0.00000001f),
+          meps = simd::floatv_t(-0.00000001f);
+
+        const auto rays = simd::int32_t<N>::loadu((int32_t*) indices);
+
+        const auto o  = stream->p.gather(rays);
+        const auto wi = stream->wi.gather(rays);
+
+        simd::float_t<N> d(stream->d, rays);
+
+        auto m = zero;
+
+        const auto all = (1 << std::min(num_rays, (uint32_t) N)) - 1;
+
+        for (auto i=0; i<num; ++i) {
+          const simd::vector3_t<N> e0(_e0.x[i], _e0.y[i], _e0.z[i]);
+          const simd::vector3_t<N> e1(_e1.x[i], _e1.y[i], _e1.z[i]);
+          const simd::vector3_t<N> v0(_v0.x[i], _v0.y[i], _v0.z[i]);
+
+          const auto t   = o - v0;
+          const auto p   = wi.cross(e1);
+          const auto det = e0.dot(p);
+          const auto ood = one / det;
+          const auto q   = t.cross(e0);
+
+          const auto us = t.dot(p) * ood;
+          const auto vs = wi.dot(q) * ood;
+          const auto ds = e1.dot(q) * ood;
+
+          const auto xmask = (det > peps) | (det < meps);
+          const auto umask = us >= zero;
+          const auto vmask = (vs >= zero) & ((us + vs) <= one);
+          const auto dmask = (ds >= zero) & (ds < d);
+
+          const auto mask = (vmask & umask & dmask & xmask);
+
+          d = simd::select(mask, d, ds);
+          m = mask | m;
+
+          if ((simd::to_mask(m) & all) == all) {
+            break;
+          }
+        }
+
+        auto mask = simd::to_mask(m) & all;
+
+        __aligned(32) float ds[N];
+        d.store(ds);
+
+        while(mask != 0) {
+          const auto r = __bscf(mask);
+          const auto x = indices[r];
+
+          if (!stream->is_hit(x)) {
+            stream->hit(x, ds[r]);
+          }
+        }
+      }
+
       template<typename Stream>
       inline void iterate_triangles(
         Stream* stream
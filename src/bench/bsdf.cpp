@@ -0,0 +1,182 @@
+/* Compares evaluating bsdfs one at a time with evaluating them in simd
+ * packets, for the lobe types packets support. Configure with
+ * -DPHOSPHORUS_BENCHMARKS=ON to build it as 'bench_bsdf' */
+#include "bsdf.hpp"
+#include "bsdf/packet.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+static const uint32_t NUM_BSDFS  = 1024;
+static const uint32_t ITERATIONS = 200;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct point_t {
+  bsdf_t bsdf;
+  Imath::V3f wi, wo;
+};
+
+Imath::V3f random_direction(std::mt19937& rng, const Imath::V3f& n) {
+  std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+
+  Imath::V3f v;
+  do {
+    v = Imath::V3f(u(rng), u(rng), u(rng));
+  } while (v.length2() > 1.0f || v.length2() < 0.0001f);
+
+  v.normalize();
+
+  // mostly above the surface, like light samples that weren't masked
+  return v.dot(n) < 0.0f && u(rng) < 0.8f ? -v : v;
+}
+
+/* bsdfs with a single lobe of a type */
+void make_points(bsdf_t::type_t type, std::vector<point_t>& points) {
+  std::mt19937 rng(type);
+  std::uniform_real_distribution<float> u(0.0f, 1.0f);
+
+  points.resize(NUM_BSDFS);
+
+  for (auto& point : points) {
+    const auto n = random_direction(rng, Imath::V3f(0.0f, 1.0f, 0.0f));
+    const Imath::Color3f weight(u(rng), u(rng), u(rng));
+
+    point.bsdf = bsdf_t();
+
+    switch (type) {
+    case bsdf_t::Diffuse:
+      {
+        bsdf::lobes::diffuse_t p;
+        p.n = n;
+        point.bsdf.add_lobe(type, weight, &p);
+        break;
+      }
+    case bsdf_t::OrenNayar:
+      {
+        bsdf::lobes::oren_nayar_t p;
+        p.n = n;
+        p.alpha = 90.0f * u(rng);
+        point.bsdf.add_lobe(type, weight, &p);
+        break;
+      }
+    case bsdf_t::Microfacet:
+      {
+        bsdf::lobes::microfacet_t p;
+        p.n = n;
+        p.distribution = bsdf::lobes::microfacet_t::GGX;
+        p.xalpha = p.yalpha = 0.05f + 0.9f * u(rng);
+        p.eta = 1.5f;
+        p.refract = 0;
+        point.bsdf.add_lobe(type, weight, &p);
+        break;
+      }
+    case bsdf_t::Sheen:
+      {
+        bsdf::lobes::sheen_t p;
+        p.n = n;
+        p.r = 0.05f + 0.9f * u(rng);
+        point.bsdf.add_lobe(type, weight, &p);
+        break;
+      }
+    default:
+      break;
+    }
+
+    point.wi = random_direction(rng, n);
+    point.wo = random_direction(rng, n);
+  }
+}
+
+double seconds(const clock_type::time_point& start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void bench(const char* name, bsdf_t::type_t type) {
+  static const auto width = bsdf::packet_t::width;
+
+  std::vector<point_t> points;
+  make_points(type, points);
+
+  std::vector<Imath::Color3f> scalar_f(NUM_BSDFS), packet_f(NUM_BSDFS);
+  std::vector<float> scalar_pdf(NUM_BSDFS), packet_pdf(NUM_BSDFS);
+
+  auto start = clock_type::now();
+  for (auto k=0u; k<ITERATIONS; ++k) {
+    for (auto i=0u; i<NUM_BSDFS; ++i) {
+      const auto& point = points[i];
+      scalar_f[i]   = point.bsdf.f(point.wi, point.wo);
+      scalar_pdf[i] = point.bsdf.pdf(point.wo, point.wi);
+    }
+  }
+  const auto scalar = seconds(start);
+
+  start = clock_type::now();
+  for (auto k=0u; k<ITERATIONS; ++k) {
+    for (auto i=0u; i<NUM_BSDFS; i+=width) {
+      const bsdf_t* bsdfs[width];
+      alignas(32) float wix[width], wiy[width], wiz[width];
+      alignas(32) float wox[width], woy[width], woz[width];
+
+      for (auto lane=0u; lane<width; ++lane) {
+        const auto& point = points[i + lane];
+
+        bsdfs[lane] = &point.bsdf;
+
+        wix[lane] = point.wi.x; wiy[lane] = point.wi.y; wiz[lane] = point.wi.z;
+        wox[lane] = point.wo.x; woy[lane] = point.wo.y; woz[lane] = point.wo.z;
+      }
+
+      const simd::vector3v_t wi(wix, wiy, wiz);
+      const simd::vector3v_t wo(wox, woy, woz);
+
+      bsdf::packet_t packet;
+      packet.load(bsdfs, width);
+
+      alignas(32) float fx[width], fy[width], fz[width], pdf[width];
+      packet.f(wi, wo).store(fx, fy, fz);
+      packet.pdf(wo, wi).store(pdf);
+
+      for (auto lane=0u; lane<width; ++lane) {
+        packet_f[i + lane]   = Imath::Color3f(fx[lane], fy[lane], fz[lane]);
+        packet_pdf[i + lane] = pdf[lane];
+      }
+    }
+  }
+  const auto packet = seconds(start);
+
+  // largest difference between both paths, relative to the scalar result
+  auto error = 0.0f;
+  for (auto i=0u; i<NUM_BSDFS; ++i) {
+    const auto a = scalar_f[i], b = packet_f[i];
+    const auto scale = std::max(1.0f, std::max(a.x, std::max(a.y, a.z)));
+
+    error = std::max(error, std::fabs(a.x - b.x) / scale);
+    error = std::max(error, std::fabs(a.y - b.y) / scale);
+    error = std::max(error, std::fabs(a.z - b.z) / scale);
+    error = std::max(error, std::fabs(scalar_pdf[i] - packet_pdf[i]) / std::max(1.0f, scalar_pdf[i]));
+  }
+
+  const auto evaluations = (double) NUM_BSDFS * ITERATIONS;
+
+  std::cout
+    << name << ": "
+    << "scalar " << (scalar / evaluations) * 1e9 << "ns, "
+    << "packet " << (packet / evaluations) * 1e9 << "ns per bsdf, "
+    << "speedup " << scalar / packet << ", "
+    << "max error " << error
+    << std::endl;
+}
+
+int main() {
+  bench("diffuse",    bsdf_t::Diffuse);
+  bench("oren nayar", bsdf_t::OrenNayar);
+  bench("ggx",        bsdf_t::Microfacet);
+  bench("sheen",      bsdf_t::Sheen);
+
+  return 0;
+}
@@ -0,0 +1,196 @@
+/* Times building the MBVH over a generated mesh, with a single thread,
+ * and with all hardware threads, and reports the speedup of the
+ * parallel build. Configure with -DPHOSPHORUS_BENCHMARKS=ON to build it
+ * as 'bench_bvh'. The number of triangles can be passed as the first
+ * argument, "--threads <n>" overrides the number of threads of the
+ * parallel build, and "--spatial-splits" enables spatial splits */
+#include "accel/bvh/binned_sah_builder.hpp"
+#include "accel/bvh/node.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t DEFAULT_TRIANGLES = 2 * 1024 * 1024;
+static const uint32_t ITERATIONS = 3;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct triangle_t {
+  Imath::V3f v[3];
+
+  inline const Imath::V3f& a() const { return v[0]; }
+  inline const Imath::V3f& b() const { return v[1]; }
+  inline const Imath::V3f& c() const { return v[2]; }
+
+  inline Imath::Box3f bounds() const {
+    Imath::Box3f out;
+    out.extendBy(v[0]);
+    out.extendBy(v[1]);
+    out.extendBy(v[2]);
+    return out;
+  }
+};
+
+typedef mbvh::node_t<SIMD_WIDTH> node_t;
+
+/* stores nodes, and leaves like the builder of accel::mbvh_t. leaves
+ * get a copy of their triangles, so adding them costs about the same */
+struct builder_t : public bvh::builder_t<node_t, triangle_t> {
+  std::mutex m;
+
+  std::vector<node_t> nodes;
+  std::vector<triangle_t> leaves;
+
+  uint32_t make_node() {
+    std::lock_guard<std::mutex> lock(m);
+    nodes.emplace_back();
+    return nodes.size() - 1;
+  }
+
+  node_t& resolve(uint32_t n) const {
+    return const_cast<node_t&>(nodes[n]);
+  }
+
+  void commit(uint32_t n, const node_t& node) {
+    std::lock_guard<std::mutex> lock(m);
+    nodes[n] = node;
+  }
+
+  uint32_t add(
+    uint32_t begin
+  , uint32_t end
+  , const std::vector<bvh::primitive_t>& primitives
+  , const std::vector<triangle_t>& things)
+  {
+    std::lock_guard<std::mutex> lock(m);
+
+    uint32_t off = leaves.size();
+    for (auto i=begin; i<end; ++i) {
+      leaves.push_back(things[primitives[i].index]);
+    }
+
+    return off;
+  }
+};
+
+/* a displaced sphere, tessellated into roughly 'num' triangles, with
+ * small triangles scattered around it, so the tree has dense, and
+ * sparse regions */
+void make_mesh(uint32_t num, std::vector<triangle_t>& out) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+
+  const auto scattered = num / 8;
+  const auto rings = (uint32_t) std::max(std::sqrt((num - scattered) / 4.0f), 2.0f);
+  const auto segments = 2 * rings;
+
+  const auto point = [&](uint32_t ring, uint32_t segment) {
+    const auto theta = (float) M_PI * ring / rings;
+    const auto phi   = 2.0f * (float) M_PI * segment / segments;
+    const auto r     = 1.0f + 0.1f * std::sin(7.0f * theta) * std::cos(5.0f * phi);
+
+    return Imath::V3f(
+      r * std::sin(theta) * std::cos(phi)
+    , r * std::cos(theta)
+    , r * std::sin(theta) * std::sin(phi));
+  };
+
+  out.clear();
+  out.reserve(2 * rings * segments + scattered);
+
+  for (auto i=0u; i<rings; ++i) {
+    for (auto j=0u; j<segments; ++j) {
+      const auto a = point(i, j),   b = point(i, j+1);
+      const auto c = point(i+1, j), d = point(i+1, j+1);
+
+      out.push_back({{ a, b, c }});
+      out.push_back({{ b, d, c }});
+    }
+  }
+
+  for (auto i=0u; i<scattered; ++i) {
+    const Imath::V3f p(4.0f * u(rng), 4.0f * u(rng), 4.0f * u(rng));
+    const auto s = 0.02f;
+
+    out.push_back({{
+      p
+    , p + Imath::V3f(s * u(rng), s * u(rng), s * u(rng))
+    , p + Imath::V3f(s * u(rng), s * u(rng), s * u(rng))
+    }});
+  }
+}
+
+/* the fastest of a few builds, in seconds */
+double bench(
+  const std::vector<triangle_t>& triangles
+, const bvh::build_options_t& options
+, uint32_t& num_nodes)
+{
+  auto best = 0.0;
+
+  for (auto i=0u; i<ITERATIONS; ++i) {
+    std::unique_ptr<builder_t> builder(new builder_t());
+
+    const auto start = clock_type::now();
+    bvh::from(builder, triangles, options);
+    const auto seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+    num_nodes = builder->nodes.size();
+    best = i == 0 ? seconds : std::min(best, seconds);
+  }
+
+  return best;
+}
+
+int main(int argc, char** argv) {
+  auto num = DEFAULT_TRIANGLES;
+  auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+  auto spatial_splits = false;
+
+  for (auto i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg == "--spatial-splits") {
+      spatial_splits = true;
+    }
+    else if (arg == "--threads" && i+1 < argc) {
+      threads = std::max((uint32_t) std::stoul(argv[++i]), 1u);
+    }
+    else {
+      num = std::stoul(arg);
+    }
+  }
+
+  std::vector<triangle_t> triangles;
+  make_mesh(num, triangles);
+
+  bvh::build_options_t serial;
+  serial.threads = 1;
+  serial.spatial_splits = spatial_splits;
+
+  auto parallel = serial;
+  parallel.threads = threads;
+
+  uint32_t serial_nodes, parallel_nodes;
+  const auto a = bench(triangles, serial, serial_nodes);
+  const auto b = bench(triangles, parallel, parallel_nodes);
+
+  std::cout
+    << triangles.size() << " triangles"
+    << (spatial_splits ? ", spatial splits" : "")
+    << std::endl
+    << "1 thread: " << a << "s, " << serial_nodes << " nodes"
+    << std::endl
+    << parallel.threads << " threads: " << b << "s, " << parallel_nodes << " nodes"
+    << std::endl
+    << "speedup " << a / b
+    << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+/* Compares shading hit points one at a time with shading them in one
+ * batch per material, like the deferred shading kernel does with, and
+ * without --scalar-shading. Configure with -DPHOSPHORUS_BENCHMARKS=ON
+ * to build it as 'bench_shading'. The material is a noise texture
+ * driving the color of a diffuse bsdf, so it can't be folded into a
+ * constant. Shaders are looked up in "<path>/shaders", the path can be
+ * passed as the first argument, and defaults to the working directory */
+#include "material.hpp"
+#include "options.hpp"
+#include "state.hpp"
+#include "utils/allocator.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+
+static const uint32_t ITERATIONS = 50;
+static const uint32_t ALLOCATOR_SIZE = 1024*1024*100; // 100MB
+
+typedef std::chrono::steady_clock clock_type;
+
+Imath::V3f random_direction(std::mt19937& rng) {
+  std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+
+  Imath::V3f v;
+  do {
+    v = Imath::V3f(u(rng), u(rng), u(rng));
+  } while (v.length2() > 1.0f || v.length2() < 0.0001f);
+
+  return v.normalize();
+}
+
+/* musgrave noise -> mix color -> diffuse bsdf -> material output */
+material_t* make_material() {
+  auto material = new material_t();
+
+  material_t::builder_t::scoped_t builder(material->builder());
+
+  builder->parameter("scale", 10.0f);
+  builder->shader("musgrave_noise_3d_node", "noise", "surface");
+
+  builder->parameter("A", Imath::Color3f(0.8f, 0.6f, 0.4f));
+  builder->parameter("B", Imath::Color3f(0.2f, 0.3f, 0.9f));
+  builder->shader("mix_color_node", "color", "surface");
+
+  builder->shader("diffuse_bsdf_node", "bsdf", "surface");
+  builder->shader("material_node", "output", "surface");
+
+  builder->connect("out", "fac", "noise", "color");
+  builder->connect("Cout", "Cs", "color", "bsdf");
+  builder->connect("Cout", "Cs", "bsdf", "output");
+
+  return material;
+}
+
+/* hit points spread over a unit cube, all of them active. interactions,
+ * and active sets hold the same number of points */
+void make_hits(interaction_t<>* hits, active_t<>* active) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> u(0.0f, 1.0f);
+
+  for (auto i=0u; i<interaction_t<>::size; ++i) {
+    const auto n = random_direction(rng);
+
+    hits->p.from(i, Imath::V3f(u(rng), u(rng), u(rng)));
+    hits->wi.from(i, n.dot(random_direction(rng)) < 0.0f ? n : -n);
+    hits->n.from(i, n);
+    hits->s[i] = u(rng);
+    hits->t[i] = u(rng);
+    hits->e.from(i, Imath::Color3f(0.0f));
+    hits->bsdf[i] = nullptr;
+  }
+
+  active->reset(0);
+}
+
+double seconds(const clock_type::time_point& start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+  const std::string path = argc > 1 ? argv[1] : ".";
+
+  parsed_options_t options;
+  material_t::boot(options, path);
+  material_t::attach();
+
+  std::unique_ptr<material_t> material(make_material());
+
+  allocator_t allocator(ALLOCATOR_SIZE);
+
+  auto hits   = new(allocator) interaction_t<>();
+  auto active = new(allocator) active_t<>();
+  make_hits(hits, active);
+
+  // shade once up front, so compiling the shader group isn't timed
+  {
+    allocator_scope_t scope(allocator);
+    material->evaluate(allocator, hits, *active);
+  }
+
+  auto start = clock_type::now();
+  for (auto k=0u; k<ITERATIONS; ++k) {
+    allocator_scope_t scope(allocator);
+    for (auto i=0u; i<active->num; ++i) {
+      material->evaluate(allocator, hits, active->index[i]);
+    }
+  }
+  const auto scalar = seconds(start);
+
+  start = clock_type::now();
+  for (auto k=0u; k<ITERATIONS; ++k) {
+    allocator_scope_t scope(allocator);
+    material->evaluate(allocator, hits, *active);
+  }
+  const auto batched = seconds(start);
+
+  const auto points = (double) ITERATIONS * active->num;
+
+  std::cout
+    << active->num << " points, " << ITERATIONS << " iterations"
+    << std::endl
+    << "one at a time: " << points / scalar << " points/s"
+    << std::endl
+    << "batched: " << points / batched << " points/s"
+    << std::endl
+    << "speedup " << scalar / batched
+    << std::endl;
+
+  return 0;
+}
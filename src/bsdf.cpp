@@ -11,6 +11,7 @@
 
 #include "math/fresnel.hpp"
 
+#include <algorithm>
 #include <cmath>
 
 namespace ct = microfacet::cook_torrance;
@@ -106,24 +107,35 @@ Imath::Color3f eval(
   return result;
 }
 
-bsdf_t::bsdf_t()
+bsdf_t::bsdf_t(uint32_t capacity)
   : lobes(0)
+  , capacity(std::min(capacity, MaxLobes))
 {}
 
+bool bsdf_t::scatters(uint32_t i, const Imath::V3f& wi, const Imath::V3f& wo) const {
+  const auto& p = lobe[i].param();
+  const auto reflect = angle_to_light(p, wi) * angle_to_light(p, wo) > 0.0f;
+
+  return (reflect && is_reflective(i)) || (!reflect && is_transmissive(i));
+}
+
 Imath::Color3f bsdf_t::f(const Imath::V3f& wi, const Imath::V3f& wo) const {
   Imath::Color3f out(0.0f);
   float ignored;
 
-  param_t* p = ((param_t*) params);
+  if (lobes == 0) {
+    return out;
+  }
 
   for (auto i=0; i<lobes; ++i) {
-    const auto e = eval(type[i], p[i], wi, wo, ignored);
+    const auto& l = lobe[i];
+    const auto  e = eval(l.type, l.param(), wi, wo, ignored);
 
-    const auto atl = angle_to_light(p[i], wi);
-    const auto reflect = atl * angle_to_light(p[i], wo) > 0.0f;
+    const auto atl = angle_to_light(l.param(), wi);
+    const auto reflect = atl * angle_to_light(l.param(), wo) > 0.0f;
 
     if ((reflect && is_reflective(i)) || (!reflect && is_transmissive(i))) {
-      out += e * weight[i] * atl;
+      out += e * l.weight * atl;
     }
   }
 
@@ -137,6 +149,14 @@ Imath::Color3f bsdf_t::sample(
 , float& pdf
 , uint32_t& sample_flags) const
 {
+  // materials with only emission get bsdfs without storage for
+  // any lobes
+  if (lobes == 0) {
+    pdf = 0.0f;
+    sample_flags = 0;
+    return Imath::Color3f(0.0f);
+  }
+
   auto index = std::min((uint32_t) std::floor(sample.x * lobes), (lobes-1));
 
   const auto one_minus_epsilon =
@@ -147,9 +167,9 @@ Imath::Color3f bsdf_t::sample(
   Imath::V2f remapped(u, sample.y);
   Imath::Color3f result(0.0f);
 
-  const auto& p = ((param_t*) params)[index];
+  const auto& p = lobe[index].param();
 
-  switch(type[index]) {
+  switch(lobe[index].type) {
   case Diffuse:
     result = lambert::sample(p.diffuse, wi, wo, remapped, pdf);
     break;
@@ -221,28 +241,42 @@ Imath::Color3f bsdf_t::sample(
     return Imath::Color3f(0.0f);
   }
 
-  result *= weight[index];
+  result *= lobe[index].weight;
 
-  auto matched_lobes = 1;
-
-  for (auto i=0; i<lobes; ++i) {
-    if (i != index && ((flags[index] & flags[i]) == flags[i])) {
-      const auto reflect = 
-        angle_to_light(((param_t*) params)[i], wi) * 
-        angle_to_light(((param_t*) params)[i], wo) > 0.0f;
-      if ((reflect && is_reflective(i)) || (!reflect && is_transmissive(i))) {
+  // a direction sampled from a glossy, or diffuse lobe could have been
+  // sampled by all other lobes that scatter into the same hemisphere.
+  // lobes are picked uniformly, so the pdf is the mean over all lobes
+  if (!is_specular(lobe[index].flags)) {
+    for (auto i=0; i<lobes; ++i) {
+      if (i != index && !is_specular(lobe[i].flags) && scatters(i, wi, wo)) {
         auto lobe_pdf = 0.0f;
 
-        result += eval(type[i], ((param_t*) params)[i], wi, wo, lobe_pdf) * weight[i];
+        result += eval(lobe[i].type, lobe[i].param(), wi, wo, lobe_pdf) * lobe[i].weight;
         pdf    += lobe_pdf;
-
-        ++matched_lobes;
       }
     }
   }
 
-  pdf /= matched_lobes;
-  sample_flags = flags[index];
+  pdf /= lobes;
+  sample_flags = lobe[index].flags;
 
   return result;
 }
+
+float bsdf_t::pdf(const Imath::V3f& wi, const Imath::V3f& wo) const {
+  auto pdf = 0.0f;
+
+  if (lobes == 0) {
+    return pdf;
+  }
+
+  for (auto i=0; i<lobes; ++i) {
+    if (!is_specular(lobe[i].flags) && scatters(i, wi, wo)) {
+      auto lobe_pdf = 0.0f;
+      eval(lobe[i].type, lobe[i].param(), wi, wo, lobe_pdf);
+      pdf += lobe_pdf;
+    }
+  }
+
+  return lobes > 0 ? pdf / lobes : 0.0f;
+}
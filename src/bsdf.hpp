@@ -3,6 +3,8 @@
 #include "bsdf/params.hpp"
 #include "utils/color.hpp"
 
+#include <cstring>
+
 /* models a surface reflection function which can be evaluated and 
  * sampled by an integrator */
 struct bsdf_t {
@@ -32,17 +34,70 @@ struct bsdf_t {
     bsdf::lobes::sheen_t sheen;
   };
 
-  type_t type[MaxLobes];
-  Imath::Color3f weight[MaxLobes];
-  uint8_t params[MaxLobes*sizeof(param_t)];
+  /* a single scattering function of the bsdf, and its weight */
+  struct lobe_t {
+    type_t type;
+    uint32_t flags;
+    Imath::Color3f weight;
+    alignas(param_t) uint8_t params[sizeof(param_t)];
+
+    inline param_t& param() {
+      return *((param_t*) params);
+    }
+
+    inline const param_t& param() const {
+      return *((const param_t*) params);
+    }
+  };
+
+  // number of lobes added to the bsdf. lobes added past the capacity
+  // are counted, but not stored
   uint32_t lobes;
-  uint32_t flags[MaxLobes];
+  // number of lobes the bsdf has storage for
+  uint32_t capacity;
+  // bsdfs are allocated with storage for 'capacity' lobes only,
+  // so this has to stay the last member
+  lobe_t lobe[MaxLobes];
+
+  bsdf_t(uint32_t capacity = MaxLobes);
+
+  /* start an empty bsdf in memory sized for 'capacity' lobes */
+  static inline bsdf_t* make(void* mem, uint32_t capacity) {
+    auto out = (bsdf_t*) mem;
+    out->lobes    = 0;
+    out->capacity = capacity < MaxLobes ? capacity : MaxLobes;
+
+    return out;
+  }
+
+  /* bytes needed by a bsdf with storage for 'capacity' lobes */
+  static inline size_t size(uint32_t capacity) {
+    return sizeof(bsdf_t) - (MaxLobes - capacity) * sizeof(lobe_t);
+  }
+
+  /* check if lobes had to be dropped, because the bsdf ran out of
+   * storage */
+  inline bool overflowed() const {
+    return lobes > capacity;
+  }
+
+  /* copy the bsdf into memory sized for its lobes only */
+  inline bsdf_t* copy(void* mem) const {
+    memcpy(mem, this, size(lobes));
+
+    auto out = (bsdf_t*) mem;
+    out->capacity = lobes;
 
-  bsdf_t();
+    return out;
+  }
 
   /* evaluate the bsdf for a given pair of directions */
   Imath::Color3f f(const Imath::V3f& wi, const Imath::V3f& wo) const;
 
+  /* the probability of sampling 'wo' for the incident direction 'wi'.
+   * this is zero for specular lobes */
+  float pdf(const Imath::V3f& wi, const Imath::V3f& wo) const;
+
   /* sample the bsdf given an incident direction */
   Imath::Color3f sample(
     const Imath::V2f& sample
@@ -53,42 +108,51 @@ struct bsdf_t {
 
   template<typename T>
   inline void add_lobe(type_t t, const Imath::Color3f& c, const T* p) {
-    type[lobes] = t;
-    flags[lobes] = T::flags;
-    weight[lobes] = c;
+    if (lobes < capacity) {
+      auto& l = lobe[lobes];
+
+      l.type   = t;
+      l.flags  = T::flags;
+      l.weight = c;
 
-    const auto index = lobes*sizeof(param_t);
-    auto param = (T*) &params[index];
+      auto param = (T*) l.params;
 
-    memcpy(param, p, sizeof(T));
-    param->precompute();
+      memcpy(param, p, sizeof(T));
+      param->precompute();
+    }
 
     ++lobes;
   }
 
   template<>
   inline void add_lobe(type_t t, const Imath::Color3f& c, const bsdf::lobes::microfacet_t* p) {
-    type[lobes] = t;
-    flags[lobes] = p->refract ? bsdf::TRANSMIT : bsdf::REFLECT;
-    weight[lobes] = c;
+    if (lobes < capacity) {
+      auto& l = lobe[lobes];
 
-    const auto index = lobes*sizeof(param_t);
-    auto param = (bsdf::lobes::microfacet_t*) &params[index];
+      l.type   = t;
+      l.flags  = p->refract ? bsdf::TRANSMIT : bsdf::REFLECT;
+      l.weight = c;
 
-    memcpy(param, p, sizeof(bsdf::lobes::microfacet_t));
-    param->precompute();
+      auto param = (bsdf::lobes::microfacet_t*) l.params;
+
+      memcpy(param, p, sizeof(bsdf::lobes::microfacet_t));
+      param->precompute();
+    }
 
     ++lobes;
   }
 
   bool is_reflective(uint32_t i) const {
-    return (flags[i] & bsdf::REFLECT) == bsdf::REFLECT;
+    return (lobe[i].flags & bsdf::REFLECT) == bsdf::REFLECT;
   }
 
   bool is_transmissive(uint32_t i) const {
-    return (flags[i] & bsdf::TRANSMIT) == bsdf::TRANSMIT;
+    return (lobe[i].flags & bsdf::TRANSMIT) == bsdf::TRANSMIT;
   }
 
+  /* lobe 'i' reflects, or transmits light between two directions */
+  bool scatters(uint32_t i, const Imath::V3f& wi, const Imath::V3f& wo) const;
+
   static bool is_specular(uint32_t flags) {
     return (flags & bsdf::SPECULAR) == bsdf::SPECULAR;
   }
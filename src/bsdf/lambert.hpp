@@ -18,7 +18,8 @@ namespace lambert {
   , const Imath::V3f& wi
   , const Imath::V3f& wo)
   {
-    return params.n.dot(wi) * M_1_PI;
+    // cosine weighted sampling of the outgoing direction
+    return std::max(0.0f, params.n.dot(wo)) * (float) M_1_PI;
   }
 
   Imath::Color3f sample(
@@ -51,7 +51,7 @@ namespace oren_nayar {
   , const Imath::V3f& wi
   , const Imath::V3f& wo)
   {
-    return params.n.dot(wi) * M_1_PI;
+    return std::max(0.0f, params.n.dot(wo)) * (float) M_1_PI;
   }
 
   Imath::Color3f sample(
@@ -0,0 +1,467 @@
+#pragma once
+
+#include "bsdf.hpp"
+#include "math/simd.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace bsdf {
+  /**
+   * Bsdfs of up to SIMD_WIDTH hit points, with the same lobes. Lobe
+   * parameters are transposed, so every simd lane holds the parameters
+   * of one bsdf, and all bsdfs get evaluated for a pair of directions
+   * each, at once. Hits with the same material mostly end up with the
+   * same lobes, so packets get filled from the hits of a material.
+   *
+   * Only diffuse, oren nayar, ggx reflection, and sheen lobes can be
+   * evaluated this way. Results match bsdf_t::f, and bsdf_t::pdf
+   */
+  struct packet_t {
+    typedef simd::floatv_t   float_t;
+    typedef simd::vector3v_t vector_t;
+
+    static const uint32_t width = SIMD_WIDTH;
+
+    uint32_t lobes;
+
+    bsdf_t::type_t type[bsdf_t::MaxLobes];
+    uint32_t       flags[bsdf_t::MaxLobes];
+
+    // shading normal, and the tangent frame around it
+    vector_t n[bsdf_t::MaxLobes];
+    vector_t s[bsdf_t::MaxLobes];
+    vector_t t[bsdf_t::MaxLobes];
+
+    vector_t weight[bsdf_t::MaxLobes];
+
+    // oren nayar: a, and b. ggx: x, and y alpha. sheen: roughness
+    float_t p0[bsdf_t::MaxLobes];
+    float_t p1[bsdf_t::MaxLobes];
+
+    /* check if all lobes of a bsdf can be evaluated in a packet */
+    static inline bool is_supported(const bsdf_t* bsdf) {
+      for (auto i=0u; i<bsdf->lobes; ++i) {
+        const auto& lobe = bsdf->lobe[i];
+
+        switch (lobe.type) {
+        case bsdf_t::Diffuse:
+        case bsdf_t::OrenNayar:
+        case bsdf_t::Sheen:
+          break;
+        case bsdf_t::Microfacet:
+          {
+            const auto& p = lobe.param().microfacet;
+            if (p.refract || !(p.is_ggx() || p.is_beckmann())) {
+              return false;
+            }
+            break;
+          }
+        default:
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /* check if two bsdfs can go into the same packet */
+    static inline bool matches(const bsdf_t* a, const bsdf_t* b) {
+      if (a->lobes != b->lobes) {
+        return false;
+      }
+
+      for (auto i=0u; i<a->lobes; ++i) {
+        if (a->lobe[i].type != b->lobe[i].type || a->lobe[i].flags != b->lobe[i].flags) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /* transpose 'num' matching bsdfs into the packet. unused lanes
+     * repeat the first bsdf */
+    inline void load(const bsdf_t* const* bsdfs, uint32_t num) {
+      const auto first = bsdfs[0];
+
+      lobes = first->lobes;
+
+      for (auto i=0u; i<lobes; ++i) {
+        type[i]  = first->lobe[i].type;
+        flags[i] = first->lobe[i].flags;
+
+        alignas(32) float nx[width], ny[width], nz[width];
+        alignas(32) float wr[width], wg[width], wb[width];
+        alignas(32) float a[width], b[width];
+
+        for (auto lane=0u; lane<width; ++lane) {
+          const auto& lobe  = bsdfs[lane < num ? lane : 0]->lobe[i];
+          const auto& param = lobe.param();
+
+          nx[lane] = param.diffuse.n.x;
+          ny[lane] = param.diffuse.n.y;
+          nz[lane] = param.diffuse.n.z;
+
+          wr[lane] = lobe.weight.x;
+          wg[lane] = lobe.weight.y;
+          wb[lane] = lobe.weight.z;
+
+          switch (type[i]) {
+          case bsdf_t::OrenNayar:
+            a[lane] = param.oren_nayar.a;
+            b[lane] = param.oren_nayar.b;
+            break;
+          case bsdf_t::Microfacet:
+            a[lane] = param.microfacet.xalpha;
+            b[lane] = param.microfacet.yalpha;
+            break;
+          case bsdf_t::Sheen:
+            a[lane] = param.sheen.r;
+            b[lane] = 0.0f;
+            break;
+          default:
+            a[lane] = b[lane] = 0.0f;
+            break;
+          }
+        }
+
+        n[i]      = vector_t(nx, ny, nz);
+        weight[i] = vector_t(wr, wg, wb);
+        p0[i]     = float_t(a);
+        p1[i]     = float_t(b);
+
+        frame(n[i], s[i], t[i]);
+      }
+    }
+
+    /* evaluate the bsdfs for pairs of directions, like bsdf_t::f */
+    inline vector_t f(const vector_t& wi, const vector_t& wo) const {
+      const float_t zero(0.0f);
+
+      vector_t out(zero, zero, zero);
+
+      for (auto i=0u; i<lobes; ++i) {
+        const auto atl = n[i].dot(wi);
+        const auto e   = eval(i, wi, wo) * atl & scatters(i, atl, n[i].dot(wo));
+
+        out = out + weight[i] * e;
+      }
+
+      return out;
+    }
+
+    /* the probabilities of sampling 'wo' for the incident directions
+     * 'wi', like bsdf_t::pdf */
+    inline float_t pdf(const vector_t& wi, const vector_t& wo) const {
+      float_t out(0.0f);
+
+      for (auto i=0u; i<lobes; ++i) {
+        if (bsdf_t::is_specular(flags[i])) {
+          continue;
+        }
+
+        const auto mask = scatters(i, n[i].dot(wi), n[i].dot(wo));
+        out = out + (lobe_pdf(i, wi, wo) & mask);
+      }
+
+      return lobes > 0 ? out * float_t(1.0f / lobes) : out;
+    }
+
+  private:
+
+    static inline float_t one() {
+      return float_t(1.0f);
+    }
+
+    static inline float_t mask(bool b) {
+      return float_t(_mm256_castsi256_ps(_mm256_set1_epi32(b ? -1 : 0)));
+    }
+
+    static inline float_t eq(const float_t& a, const float_t& b) {
+      return float_t(simd::eq(a.v, b.v));
+    }
+
+    static inline float_t neq(const float_t& a, const float_t& b) {
+      return float_t(_mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ));
+    }
+
+    static inline float_t is_inf(const float_t& x) {
+      return eq(simd::abs(x), float_t(std::numeric_limits<float>::infinity()));
+    }
+
+    static inline vector_t normalized(const vector_t& v) {
+      return v * (one() / v.length());
+    }
+
+    /* apply a scalar function to all lanes */
+    template<typename F>
+    static inline float_t map(const float_t& x, F fn) {
+      alignas(32) float v[width];
+      x.store(v);
+      for (auto i=0u; i<width; ++i) {
+        v[i] = fn(v[i]);
+      }
+      return float_t(v);
+    }
+
+    /* the same tangent frame orthogonal_base_t builds around a normal */
+    static inline void frame(const vector_t& n, vector_t& s, vector_t& t) {
+      const float_t nx(n.x), ny(n.y), nz(n.z);
+
+      const auto distinct = neq(nx, ny) | neq(nx, nz);
+
+      const vector_t a(nz - ny, nx - nz, ny - nx);
+      const vector_t b(nz - ny, nx + nz, float_t(0.0f) - ny - nx);
+
+      s = normalized(vector_t(
+        simd::select(distinct, float_t(b.x), float_t(a.x))
+      , simd::select(distinct, float_t(b.y), float_t(a.y))
+      , simd::select(distinct, float_t(b.z), float_t(a.z))));
+      t = normalized(s.cross(n));
+    }
+
+    inline vector_t to_local(uint32_t i, const vector_t& v) const {
+      return vector_t(s[i].dot(v), n[i].dot(v), t[i].dot(v));
+    }
+
+    /* lanes where lobe 'i' scatters light between two directions,
+     * given their cosines with the lobe normal */
+    inline float_t scatters(uint32_t i, const float_t& cos_i, const float_t& cos_o) const {
+      const auto reflect = cos_i * cos_o > float_t(0.0f);
+
+      const auto reflective   = (flags[i] & bsdf::REFLECT) == bsdf::REFLECT;
+      const auto transmissive = (flags[i] & bsdf::TRANSMIT) == bsdf::TRANSMIT;
+
+      return
+        (reflect & mask(reflective)) |
+        (simd::andnot(reflect, mask(transmissive)));
+    }
+
+    /* trigonometry in tangent space, like the functions in ts:: */
+    static inline float_t sin2_theta(const vector_t& v) {
+      return simd::max(float_t(0.0f), one() - float_t(v.y) * float_t(v.y));
+    }
+
+    static inline float_t sin_theta(const vector_t& v) {
+      return simd::sqrt(sin2_theta(v));
+    }
+
+    static inline float_t cos_phi(const vector_t& v, const float_t& sin_t) {
+      const auto c = simd::max(float_t(-1.0f), simd::min(float_t(v.x) / sin_t, one()));
+      return simd::select(eq(sin_t, float_t(0.0f)), c, one());
+    }
+
+    static inline float_t sin_phi(const vector_t& v, const float_t& sin_t) {
+      const auto c = simd::max(float_t(-1.0f), simd::min(float_t(v.z) / sin_t, one()));
+      return simd::select(eq(sin_t, float_t(0.0f)), c, float_t(0.0f));
+    }
+
+    static inline float_t cosine_pdf(const vector_t& n, const vector_t& wo) {
+      return simd::max(float_t(0.0f), n.dot(wo)) * float_t((float) M_1_PI);
+    }
+
+    inline float_t lobe_pdf(uint32_t i, const vector_t& wi, const vector_t& wo) const {
+      switch (type[i]) {
+      case bsdf_t::Microfacet:
+        return ggx_pdf(i, wi, wo);
+      default:
+        return cosine_pdf(n[i], wo);
+      }
+    }
+
+    inline float_t eval(uint32_t i, const vector_t& wi, const vector_t& wo) const {
+      switch (type[i]) {
+      case bsdf_t::Diffuse:
+        return float_t((float) M_1_PI);
+      case bsdf_t::OrenNayar:
+        return oren_nayar(i, wi, wo);
+      case bsdf_t::Microfacet:
+        return microfacet(i, wi, wo, false);
+      case bsdf_t::Sheen:
+        return microfacet(i, wi, wo, true);
+      default:
+        return float_t(0.0f);
+      }
+    }
+
+    inline float_t oren_nayar(uint32_t i, const vector_t& wi, const vector_t& wo) const {
+      const auto li = to_local(i, wi);
+      const auto lo = to_local(i, wo);
+
+      const auto cos_ti = simd::abs(float_t(li.y));
+      const auto cos_to = simd::abs(float_t(lo.y));
+      const auto sin_ti = sin_theta(li);
+      const auto sin_to = sin_theta(lo);
+
+      const auto dcos =
+        cos_phi(li, sin_ti) * cos_phi(lo, sin_to) +
+        sin_phi(li, sin_ti) * sin_phi(lo, sin_to);
+
+      const auto has_phi = (sin_ti > float_t(0.0001f)) & (sin_to > float_t(0.0001f));
+      const auto max_cos = simd::max(float_t(0.0f), dcos) & has_phi;
+
+      const auto i_larger  = cos_ti > cos_to;
+      const auto sin_alpha = simd::select(i_larger, sin_ti, sin_to);
+      const auto tan_beta  = simd::select(i_larger, sin_to / cos_to, sin_ti / cos_ti);
+
+      return (p0[i] + p1[i] * max_cos * sin_alpha * tan_beta) * float_t((float) M_1_PI);
+    }
+
+    /* ggx distribution */
+    inline float_t ggx_d(uint32_t i, const vector_t& v) const {
+      const auto cos2  = float_t(v.y) * float_t(v.y);
+      const auto sin2  = sin2_theta(v);
+      const auto sin_t = simd::sqrt(sin2);
+      const auto tan2  = sin2 / cos2;
+
+      const auto ax = p0[i];
+      const auto ay = p1[i];
+
+      const auto cp = cos_phi(v, sin_t);
+      const auto sp = sin_phi(v, sin_t);
+
+      const auto e = (cp * cp / (ax * ax) + sp * sp / (ay * ay)) * tan2;
+      const auto d = one() / (float_t((float) M_PI) * ax * ay * cos2 * cos2 * (one() + e) * (one() + e));
+
+      return simd::andnot(is_inf(tan2), d);
+    }
+
+    inline float_t ggx_lambda(uint32_t i, const vector_t& v) const {
+      const auto sin_t   = sin_theta(v);
+      const auto abs_tan = simd::abs(sin_t / float_t(v.y));
+
+      const auto ax = p0[i];
+      const auto ay = p1[i];
+
+      const auto cp = cos_phi(v, sin_t);
+      const auto sp = sin_phi(v, sin_t);
+
+      const auto alpha = simd::sqrt(cp * cp * ax * ay + sp * sp * ax * ay);
+      const auto x     = alpha * abs_tan;
+
+      const auto lambda = (simd::sqrt(one() + x * x) - one()) * float_t(0.5f);
+
+      return simd::andnot(is_inf(abs_tan), lambda);
+    }
+
+    /* polynomial fit of the sheen shadowing term */
+    static inline float_t sheen_l(const float_t& x, const float_t& r) {
+      static const float p0[] = { 25.3245f, 3.32435f, 0.16801f, -1.27393f, -4.85967f };
+      static const float p1[] = { 21.5473f, 3.82987f, 0.19823f, -1.97760f, -4.32054f };
+
+      const auto t = (one() - r) * (one() - r);
+
+      const auto interp = [&](uint32_t k) {
+        return t * float_t(p0[k]) + (one() - t) * float_t(p1[k]);
+      };
+
+      const auto a = interp(0), b = interp(1), c = interp(2), d = interp(3), e = interp(4);
+
+      alignas(32) float xs[width], cs[width];
+      x.store(xs);
+      c.store(cs);
+      for (auto k=0u; k<width; ++k) {
+        xs[k] = std::pow(xs[k], cs[k]);
+      }
+
+      return a / (one() + b * float_t(xs)) + d * x + e;
+    }
+
+    inline float_t sheen_d(uint32_t i, const vector_t& v) const {
+      const auto oor = one() / p0[i];
+
+      alignas(32) float ss[width], es[width];
+      sin_theta(v).store(ss);
+      oor.store(es);
+      for (auto k=0u; k<width; ++k) {
+        ss[k] = std::pow(ss[k], es[k]);
+      }
+
+      return (float_t(2.0f) + oor) * float_t(ss) * float_t((float) (0.5 * M_1_PI));
+    }
+
+    inline float_t sheen_lambda(uint32_t i, const vector_t& v) const {
+      const auto r  = p0[i];
+      const float_t cos_t(v.y);
+
+      const auto low  = sheen_l(cos_t, r);
+      const auto high = float_t(2.0f) * sheen_l(float_t(0.5f), r) - sheen_l(one() - cos_t, r);
+
+      return map(simd::select(cos_t < float_t(0.5f), high, low), [](float l) {
+        return std::exp(l);
+      });
+    }
+
+    /* fresnel::dielectric for a fixed index of refraction */
+    static inline float_t dielectric(const float_t& cosi, float eta) {
+      const auto e = simd::select(cosi < float_t(0.0f), float_t(eta), float_t(1.0f / eta));
+      const auto c = simd::abs(cosi);
+      const auto g2 = e * e - one() + c * c;
+      const auto g  = simd::sqrt(simd::max(g2, float_t(0.0f)));
+
+      const auto a = (g - c) / (g + c);
+      const auto b = (c * (g + c) - one()) / (c * (g - c) + one());
+
+      const auto f = float_t(0.5f) * a * a * (one() + b * b);
+
+      return simd::select(g2 > float_t(0.0f), one(), f);
+    }
+
+    /* cook torrance reflection, with a ggx, or sheen distribution */
+    inline float_t microfacet(uint32_t i, const vector_t& wi, const vector_t& wo, bool sheen) const {
+      const auto li = to_local(i, wi);
+      const auto lo = to_local(i, wo);
+
+      const auto same = float_t(li.y) * float_t(lo.y) > float_t(0.0f);
+
+      auto wh = li + lo;
+
+      const auto degenerate =
+        eq(float_t(wh.x), float_t(0.0f)) |
+        eq(float_t(wh.y), float_t(0.0f)) |
+        eq(float_t(wh.z), float_t(0.0f));
+
+      wh = normalized(wh);
+
+      const auto cos_ti = simd::abs(float_t(li.y));
+      const auto cos_to = simd::abs(float_t(lo.y));
+
+      float_t d, g;
+      if (sheen) {
+        d = sheen_d(i, wh);
+        g = one() / (one() + sheen_lambda(i, li) + sheen_lambda(i, lo));
+      }
+      else {
+        d = ggx_d(i, wh);
+        g = one() / (one() + ggx_lambda(i, li) + ggx_lambda(i, lo));
+      }
+
+      // the half vector facing up
+      const auto flip = float_t(wh.y) < float_t(0.0f);
+      const auto sign = simd::select(flip, one(), float_t(-1.0f));
+
+      const auto f = dielectric(lo.dot(wh) * sign, 0.5f);
+      const auto c = d * g * f / (float_t(4.0f) * cos_ti * cos_to);
+
+      return simd::andnot(degenerate, c & same);
+    }
+
+    inline float_t ggx_pdf(uint32_t i, const vector_t& wi, const vector_t& wo) const {
+      const auto li = to_local(i, wi);
+      const auto lo = to_local(i, wo);
+
+      const auto same = float_t(li.y) * float_t(lo.y) > float_t(0.0f);
+
+      const auto wh = normalized(li + lo);
+      const auto dh = li.dot(wh);
+
+      // the shadowing term uses the world space direction, the same
+      // way the scalar pdf does
+      const auto g1 = one() / (one() + ggx_lambda(i, wi));
+
+      const auto pdf =
+        (ggx_d(i, wh) * g1 * simd::abs(dh) / simd::abs(float_t(li.y))) / (float_t(4.0f) * dh);
+
+      return pdf & same;
+    }
+  };
+}
@@ -54,7 +54,7 @@ namespace microfacet {
       {
         using details::L;
 
-        static const auto L5 = L(0.5f, params.r);
+        const auto L5 = L(0.5f, params.r);
 
         const auto cos_theta = ts::cos_theta(v);
         const auto l = (cos_theta < 0.5f) ?
@@ -69,7 +69,7 @@ namespace microfacet {
     , const Imath::V3f& wi
     , const Imath::V3f& wo)
     {
-      return params.n.dot(wi) * M_1_PI;
+      return std::max(0.0f, params.n.dot(wo)) * (float) M_1_PI;
     }
 
     Imath::Color3f sample(
@@ -29,6 +29,13 @@ void render_buffer_t::channel_t::add(int x, int y, const Imath::V3f& v) {
   buffer->buffer[index + 2] += v.z;
 };
 
+void render_buffer_t::channel_t::scale(int x, int y, float s) {
+  const auto index = offset + y * buffer->ystride + x * buffer->xstride;
+  buffer->buffer[index    ] *= s;
+  buffer->buffer[index + 1] *= s;
+  buffer->buffer[index + 2] *= s;
+};
+
 const void render_buffer_t::channel_t::get(uint32_t x, uint32_t y, float* out) const {
   const auto index = offset + y * buffer->ystride + x * buffer->xstride;
   const auto from  = buffer->buffer + index;
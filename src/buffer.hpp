@@ -50,6 +50,9 @@ struct render_buffer_t {
     /* add to a pixel in the render buffer */
     void add(int x, int y, const Imath::V3f& c);
 
+    /* multiply a pixel in the render buffer */
+    void scale(int x, int y, float s);
+
     /* extract one pixel from the channel, and write it to out */
     const void get(uint32_t x, uint32_t y, float* out) const;
 
@@ -12,6 +12,32 @@
 #include <getopt.h>
 #include <sys/time.h>
 
+/* arguments without a short form */
+enum long_option_t {
+  OPTION_SBVH = 256,
+  OPTION_BVH_CACHE,
+  OPTION_COMPRESS_BVH,
+  OPTION_STREAM_THRESHOLD,
+  OPTION_SORT_RAYS,
+  OPTION_SEED,
+  OPTION_SAMPLER,
+  OPTION_LIGHT_TREE,
+  OPTION_REGENERATE,
+  OPTION_SCALAR_SHADING,
+  OPTION_SCALAR_BSDFS,
+  OPTION_TILE_SIZE,
+  OPTION_TILE_ORDER,
+  OPTION_PROGRESSIVE,
+  OPTION_SAMPLES_PER_PASS,
+  OPTION_PUBLISH_INTERVAL,
+  OPTION_TIME_LIMIT,
+  OPTION_NOISE_THRESHOLD,
+  OPTION_MIN_SAMPLES,
+  OPTION_MAX_SAMPLES,
+  OPTION_PIN_THREADS,
+  OPTION_REPLICATE_BVH
+};
+
 /* available arguments to the renderer */
 static option options[] = {
   { "output",     0,                 NULL, 'o' },
@@ -20,7 +46,30 @@ static option options[] = {
   { "spp",        required_argument, NULL, 's' },
   { "paths",      required_argument, NULL, 'p' },
   { "depth",      required_argument, NULL, 'd' },
-  { "verbose",    no_argument,       NULL, 'v' }
+  { "verbose",    no_argument,       NULL, 'v' },
+  { "sbvh",       no_argument,       NULL, OPTION_SBVH },
+  { "bvh-cache",  required_argument, NULL, OPTION_BVH_CACHE },
+  { "compress-bvh", no_argument,     NULL, OPTION_COMPRESS_BVH },
+  { "stream-threshold", required_argument, NULL, OPTION_STREAM_THRESHOLD },
+  { "sort-rays",  no_argument,       NULL, OPTION_SORT_RAYS },
+  { "seed",       required_argument, NULL, OPTION_SEED },
+  { "sampler",    required_argument, NULL, OPTION_SAMPLER },
+  { "light-tree", no_argument,       NULL, OPTION_LIGHT_TREE },
+  { "regenerate", no_argument,       NULL, OPTION_REGENERATE },
+  { "scalar-shading", no_argument,   NULL, OPTION_SCALAR_SHADING },
+  { "scalar-bsdfs", no_argument,     NULL, OPTION_SCALAR_BSDFS },
+  { "tile-size",  required_argument, NULL, OPTION_TILE_SIZE },
+  { "tile-order", required_argument, NULL, OPTION_TILE_ORDER },
+  { "progressive", no_argument,      NULL, OPTION_PROGRESSIVE },
+  { "samples-per-pass", required_argument, NULL, OPTION_SAMPLES_PER_PASS },
+  { "publish-interval", required_argument, NULL, OPTION_PUBLISH_INTERVAL },
+  { "time-limit", required_argument, NULL, OPTION_TIME_LIMIT },
+  { "noise-threshold", required_argument, NULL, OPTION_NOISE_THRESHOLD },
+  { "min-samples", required_argument, NULL, OPTION_MIN_SAMPLES },
+  { "max-samples", required_argument, NULL, OPTION_MAX_SAMPLES },
+  { "pin-threads", no_argument,      NULL, OPTION_PIN_THREADS },
+  { "replicate-bvh", no_argument,    NULL, OPTION_REPLICATE_BVH },
+  { NULL,         0,                 NULL, 0 }
 };
 
 void usage() {
@@ -31,13 +80,36 @@ void usage() {
     << "-s <samples> Anti Aliasing samples per pixel" << std::endl
     << "-p <paths>   Maximum number of paths traces per sample" << std::endl
     << "-d <depth>   Maximum depth of a single path" << std::endl
-    << "-v           Print statistics while rendering" << std::endl;
+    << "-v           Print statistics while rendering" << std::endl
+    << "--sbvh       Build the BVH with spatial splits" << std::endl
+    << "--bvh-cache <dir> Cache built BVHs in a directory" << std::endl
+    << "--compress-bvh    Quantize BVH node bounds to 8 bit" << std::endl
+    << "--stream-threshold <n> Trace streams of less than n rays one ray at a time" << std::endl
+    << "--sort-rays       Sort secondary rays by direction and origin" << std::endl
+    << "--seed <n>        Seed for the random number generators" << std::endl
+    << "--sampler <name>  Sample sequence: random, sobol (default), or pmj02" << std::endl
+    << "--light-tree      Pick lights based on their contribution at a shading point" << std::endl
+    << "--regenerate      Start new paths as soon as others terminate" << std::endl
+    << "--scalar-shading  Shade hit points one at a time, instead of per material" << std::endl
+    << "--scalar-bsdfs    Evaluate bsdfs one hit point at a time, instead of in simd packets" << std::endl
+    << "--tile-size <n>   Render the image in tiles of n x n pixels" << std::endl
+    << "--tile-order <name> Tile order: rows, hilbert (default), or spiral" << std::endl
+    << "--progressive     Render the whole frame one sample at a time" << std::endl
+    << "--samples-per-pass <n> Samples per pixel of every progressive pass" << std::endl
+    << "--publish-interval <s> Write intermediate images at most every s seconds" << std::endl
+    << "--time-limit <s>  Stop taking samples after s seconds" << std::endl
+    << "--noise-threshold <e> Sample pixels adaptively, until their relative error is below e" << std::endl
+    << "--min-samples <n> Paths every pixel gets with adaptive sampling" << std::endl
+    << "--max-samples <n> Paths a pixel gets at most with adaptive sampling" << std::endl
+    << "--pin-threads     Pin render threads to cpus, and their memory to numa nodes" << std::endl
+    << "--replicate-bvh   Copy the BVH to every numa node (implies --pin-threads)" << std::endl;
 }
 
 bool parse_args(int argc, char** argv, parsed_options_t& parsed) {
-  char ch;
+  int ch;
+  bool adaptive = false;
 
-  while ((ch = getopt_long(argc, argv, "c1o:p:s:d:", options, nullptr)) != -1) {
+  while ((ch = getopt_long(argc, argv, "c1o:p:s:d:v", options, nullptr)) != -1) {
     switch (ch) {
     case 'o':
       parsed.output = optarg;
@@ -64,6 +136,97 @@ bool parse_args(int argc, char** argv, parsed_options_t& parsed) {
       break;
     case 'v':
       parsed.verbose = true;
+      break;
+    case OPTION_SBVH:
+      std::cout << "Building BVH with spatial splits" << std::endl;
+      parsed.spatial_splits = true;
+      break;
+    case OPTION_BVH_CACHE:
+      std::cout << "BVH cache: " << optarg << std::endl;
+      parsed.bvh_cache = optarg;
+      break;
+    case OPTION_COMPRESS_BVH:
+      std::cout << "Compressed BVH nodes" << std::endl;
+      parsed.compress_bvh = true;
+      break;
+    case OPTION_STREAM_THRESHOLD:
+      std::cout << "Stream threshold: " << std::atoi(optarg) << std::endl;
+      parsed.stream_threshold = std::atoi(optarg);
+      break;
+    case OPTION_SORT_RAYS:
+      std::cout << "Sorting secondary rays" << std::endl;
+      parsed.sort_rays = true;
+      break;
+    case OPTION_SEED:
+      std::cout << "Seed: " << std::strtoul(optarg, nullptr, 10) << std::endl;
+      parsed.seed = std::strtoul(optarg, nullptr, 10);
+      break;
+    case OPTION_SAMPLER:
+      std::cout << "Sampler: " << optarg << std::endl;
+      parsed.sampler = optarg;
+      break;
+    case OPTION_LIGHT_TREE:
+      std::cout << "Sampling lights with a light tree" << std::endl;
+      parsed.light_tree = true;
+      break;
+    case OPTION_REGENERATE:
+      std::cout << "Regenerating paths" << std::endl;
+      parsed.regenerate_paths = true;
+      break;
+    case OPTION_SCALAR_SHADING:
+      std::cout << "Shading hit points one at a time" << std::endl;
+      parsed.batch_shading = false;
+      break;
+    case OPTION_SCALAR_BSDFS:
+      std::cout << "Evaluating bsdfs one hit point at a time" << std::endl;
+      parsed.packet_bsdfs = false;
+      break;
+    case OPTION_TILE_SIZE:
+      std::cout << "Tile size: " << std::atoi(optarg) << std::endl;
+      parsed.tile_size = std::atoi(optarg);
+      break;
+    case OPTION_TILE_ORDER:
+      std::cout << "Tile order: " << optarg << std::endl;
+      parsed.tile_order = optarg;
+      break;
+    case OPTION_PROGRESSIVE:
+      std::cout << "Progressive rendering" << std::endl;
+      parsed.progressive = true;
+      break;
+    case OPTION_SAMPLES_PER_PASS:
+      std::cout << "Samples per pass: " << std::atoi(optarg) << std::endl;
+      parsed.samples_per_pass = std::atoi(optarg);
+      break;
+    case OPTION_PUBLISH_INTERVAL:
+      std::cout << "Publish interval: " << std::atof(optarg) << std::endl;
+      parsed.publish_interval = std::atof(optarg);
+      break;
+    case OPTION_TIME_LIMIT:
+      std::cout << "Time limit: " << std::atof(optarg) << std::endl;
+      parsed.time_limit = std::atof(optarg);
+      break;
+    case OPTION_NOISE_THRESHOLD:
+      std::cout << "Noise threshold: " << std::atof(optarg) << std::endl;
+      parsed.noise_threshold = std::atof(optarg);
+      adaptive = true;
+      break;
+    case OPTION_MIN_SAMPLES:
+      std::cout << "Minimum samples: " << std::atoi(optarg) << std::endl;
+      parsed.min_samples = std::atoi(optarg);
+      break;
+    case OPTION_MAX_SAMPLES:
+      std::cout << "Maximum samples: " << std::atoi(optarg) << std::endl;
+      parsed.max_samples = std::atoi(optarg);
+      break;
+    case OPTION_PIN_THREADS:
+      std::cout << "Pinning render threads" << std::endl;
+      parsed.pin_threads = true;
+      break;
+    case OPTION_REPLICATE_BVH:
+      std::cout << "Replicating the BVH per numa node" << std::endl;
+      parsed.pin_threads   = true;
+      parsed.replicate_bvh = true;
+      break;
     case '?':
     default:
       usage();
@@ -71,6 +234,12 @@ bool parse_args(int argc, char** argv, parsed_options_t& parsed) {
     }
   }
 
+  // a noise threshold renders with adaptive sampling, no matter
+  // how many samples per pixel were asked for
+  if (adaptive) {
+    parsed.samples_per_pixel = 0;
+  }
+
   const auto remaining = argc - optind;
 
   if (remaining < 1) {
@@ -142,12 +311,16 @@ int main(int argc, char** argv) {
   film::file_t* sink = new film::file_t(scene.camera.film, options.output);
   sampler_t* sampler = new sampler_t(options);
 
+  render_buffer_t::descriptor_t format;
+  format.request(render_buffer_t::PRIMARY, 3);
+
   frame_state_t state(
     sampler
   , job::tiles_t::make(
       scene.camera.film.width
     , scene.camera.film.height
-    , 32)
+    , options
+    , format)
   , sink);
 
   std::cout << "Preprocessing" << std::endl;
@@ -170,6 +343,13 @@ int main(int argc, char** argv) {
   timeval end;
   gettimeofday(&end, 0);
 
+  if (options.verbose) {
+    std::cout
+      << "Tiles stolen: " << state.tiles->stolen
+      << ", split: " << state.tiles->split
+      << std::endl;
+  }
+
   std::cout
     << "Rendering time: "
     << ((end.tv_sec - start.tv_sec) +
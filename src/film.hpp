@@ -13,4 +13,8 @@ struct film_t {
     const Imath::V2i& pos
   , const Imath::V2i& size
   , const render_buffer_t& buffer) = 0;
+
+  /* all tiles of an intermediate image were added. progressive
+   * rendering publishes a new image after some of its passes */
+  virtual void publish() {}
 };
@@ -40,6 +40,10 @@ namespace film {
     );
   }
 
+  void file_t::publish() {
+    details->image.write(details->path);
+  }
+
   void file_t::finalize() {
     details->image.write(details->path);
   }
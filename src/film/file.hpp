@@ -16,6 +16,9 @@ namespace film {
     , const Imath::V2i& size
     , const render_buffer_t& buffer);
 
+    // write intermediate images to the output path as well
+    void publish();
+
     void finalize();
   };
 }
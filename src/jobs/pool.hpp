@@ -0,0 +1,187 @@
+#pragma once
+
+#include "utils/nocopy.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace job {
+  /* A pool of worker threads executing small tasks. Every worker owns a
+   * queue. Tasks spawned from a worker go to the back of its own queue,
+   * and are popped from there again (depth first, which keeps the working
+   * set small). Idle workers steal from the front of other queues, which
+   * is where the largest pieces of work end up in recursive algorithms.
+   *
+   * The thread that creates the pool takes part in the execution of tasks
+   * whenever it waits for a group of tasks to finish */
+  struct pool_t : nocopy_t {
+    typedef std::function<void ()> task_t;
+
+    /* a set of tasks that can be waited on */
+    struct group_t {
+      std::atomic<uint32_t> pending;
+
+      inline group_t()
+        : pending(0)
+      {}
+    };
+
+    struct queue_t {
+      std::mutex m;
+      std::deque<std::pair<task_t, group_t*>> tasks;
+    };
+
+    std::vector<queue_t*> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<bool> done;
+
+    inline pool_t(uint32_t concurrency)
+      : done(false)
+    {
+      concurrency = std::max(concurrency, 1u);
+
+      for (auto i=0; i<concurrency; ++i) {
+        queues.push_back(new queue_t());
+      }
+
+      // the creating thread acts as worker 0
+      attach(0);
+
+      for (auto i=1; i<concurrency; ++i) {
+        workers.emplace_back([this, i]() {
+          attach(i);
+
+          while (!done) {
+            if (!run_one()) {
+              std::this_thread::yield();
+            }
+          }
+        });
+      }
+    }
+
+    inline ~pool_t() {
+      done = true;
+
+      for (auto& worker : workers) {
+        worker.join();
+      }
+
+      for (auto& queue : queues) {
+        delete queue;
+      }
+
+      detach();
+    }
+
+    inline uint32_t size() const {
+      return queues.size();
+    }
+
+    /* schedule a task as part of a group */
+    inline void spawn(group_t& group, const task_t& task) {
+      auto& queue = *queues[current()];
+
+      ++group.pending;
+
+      std::lock_guard<std::mutex> lock(queue.m);
+      queue.tasks.emplace_back(task, &group);
+    }
+
+    /* wait for all tasks in a group, and execute other pending tasks
+     * in the meantime */
+    inline void wait(group_t& group) {
+      while (group.pending > 0) {
+        if (!run_one()) {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    /* split a range of indices into chunks of at least 'grain' elements,
+     * and run them in parallel */
+    template<typename F>
+    inline void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, const F& f) {
+      const auto num    = end - begin;
+      const auto chunks = std::max(1u, std::min(size() * 4, num / std::max(grain, 1u)));
+      const auto step   = (num + chunks - 1) / chunks;
+
+      group_t group;
+
+      for (auto i=begin; i<end; i+=step) {
+        const auto to = std::min(i + step, end);
+        spawn(group, [&f, i, to]() { f(i, to); });
+      }
+
+      wait(group);
+    }
+
+  private:
+    /* the worker index of the calling thread. threads that don't belong
+     * to this pool share the queue of worker 0 */
+    inline int32_t current() const {
+      const auto& id = worker();
+      return id.first == this ? id.second : 0;
+    }
+
+    inline void attach(int32_t i) {
+      worker() = std::make_pair(this, i);
+    }
+
+    inline void detach() {
+      worker() = std::make_pair(nullptr, -1);
+    }
+
+    static inline std::pair<const pool_t*, int32_t>& worker() {
+      static thread_local std::pair<const pool_t*, int32_t> id(nullptr, -1);
+      return id;
+    }
+
+    inline bool pop(uint32_t i, std::pair<task_t, group_t*>& out, bool steal) {
+      auto& queue = *queues[i];
+
+      std::lock_guard<std::mutex> lock(queue.m);
+      if (queue.tasks.empty()) {
+        return false;
+      }
+
+      if (steal) {
+        out = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      else {
+        out = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      }
+
+      return true;
+    }
+
+    /* run one task from the local queue, or steal one from another
+     * worker. returns false if there was nothing to do */
+    inline bool run_one() {
+      const auto self = current();
+      const auto num  = size();
+
+      std::pair<task_t, group_t*> task;
+
+      auto found = pop(self, task, false);
+      for (auto i=1; !found && i<num; ++i) {
+        found = pop((self + i) % num, task, true);
+      }
+
+      if (found) {
+        task.first();
+        --task.second->pending;
+      }
+
+      return found;
+    }
+  };
+}
@@ -1,12 +1,28 @@
 #pragma once
 
 #include "buffer.hpp"
+#include "options.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace job {
-  /* A job that describes a set of precomputed tiles to be rendered */
+  /* A job that describes a set of precomputed tiles to be rendered.
+   *
+   * Tiles are ordered along a space filling curve, and the ordered
+   * tiles are dealt out to the render threads in contiguous runs, so
+   * a thread renders neighbouring tiles, which touch similar textures,
+   * and parts of the BVH. Every thread takes tiles from the front of
+   * its own queue. Threads that run out of tiles steal from the back
+   * of other queues. Near the end of a frame stolen tiles get split,
+   * so the last few expensive tiles get shared by more threads */
   struct tiles_t {
     struct tile_t {
       uint32_t x, y;
@@ -17,41 +33,102 @@ namespace job {
       }
     };
 
-    uint32_t size;
-    tile_t*  tiles;
+    /* the order tiles are rendered in */
+    enum order_t {
+      ROWS,
+      HILBERT,
+      SPIRAL
+    };
+
+    /* tiles of one render thread */
+    struct queue_t {
+      std::mutex m;
+      std::deque<tile_t> tiles;
+    };
+
+    // tiles smaller than this in both dimensions don't get split
+    static const uint32_t MIN_SPLIT_SIZE = 8;
+
+    // size of the image, and all of its tiles in rendering order
+    uint32_t width, height;
+    std::vector<tile_t> all;
 
-    std::atomic<uint32_t> tile;
+    std::vector<queue_t*> queues;
+
+    // tiles not handed out yet, over all queues
+    std::atomic<uint32_t> remaining;
+
+    // scheduling statistics
+    std::atomic<uint32_t> stolen;
+    std::atomic<uint32_t> split;
 
     // format for the render output of each tile. this specifies which
-    // information gets exported from the renderer, like normals, depth 
+    // information gets exported from the renderer, like normals, depth
     // information, etc.
     render_buffer_t::descriptor_t format;
 
-    inline tiles_t(uint32_t size, const render_buffer_t::descriptor_t& format)
-      : size(size), tile(0), format(format)
+    inline tiles_t(uint32_t workers, const render_buffer_t::descriptor_t& format)
+      : width(0), height(0), remaining(0), stolen(0), split(0), format(format)
     {
-      tiles = new tile_t[size];
+      workers = std::max(workers, 1u);
+
+      for (auto i=0; i<workers; ++i) {
+        queues.push_back(new queue_t());
+      }
     }
 
     inline ~tiles_t() {
-      delete[] tiles;
+      for (auto& queue : queues) {
+        delete queue;
+      }
     }
 
-    const bool next(tile_t& out) {
-      const auto t = tile++;
-      if (t < size) {
-      	out = tiles[t];
-      	return true;
+    /* the next tile for a render thread. returns false once all tiles
+     * of the frame were handed out */
+    const bool next(uint32_t worker, tile_t& out) {
+      const auto num  = (uint32_t) queues.size();
+      const auto self = worker % num;
+
+      if (pop(self, out)) {
+        return true;
       }
+
+      for (auto i=1; i<num; ++i) {
+        if (steal((self + i) % num, self, out)) {
+          return true;
+        }
+      }
+
       return false;
     }
 
+    static order_t order(const std::string& name) {
+      if (name == "rows") {
+        return ROWS;
+      }
+      else if (name == "spiral") {
+        return SPIRAL;
+      }
+      else if (name != "hilbert") {
+        std::cerr
+          << "Unknown tile order: " << name << ", using hilbert" << std::endl;
+      }
+      return HILBERT;
+    }
+
+    /* the number of threads that render tiles on the cpu */
+    static uint32_t workers(const parsed_options_t& options) {
+      return options.single_threaded ? 1 : std::thread::hardware_concurrency();
+    }
+
     static tiles_t* make(
-      uint32_t width, 
-      uint32_t height, 
-      uint32_t tile_size, 
-      const render_buffer_t::descriptor_t& format) 
+      uint32_t width,
+      uint32_t height,
+      const parsed_options_t& options,
+      const render_buffer_t::descriptor_t& format)
     {
+      const auto tile_size = std::max(options.tile_size, 1u);
+
       auto htiles = width / tile_size;
       auto vtiles = height / tile_size;
 
@@ -66,7 +143,10 @@ namespace job {
         htiles++;
       }
 
-      auto queue = new tiles_t(htiles*vtiles, format);
+      std::vector<tile_t> tiles;
+      std::vector<uint32_t> keys;
+
+      const auto o = order(options.tile_order);
 
       for (auto y=0u; y<vtiles; ++y) {
 	      for (auto x=0u; x<htiles; ++x) {
@@ -81,11 +161,169 @@ namespace job {
             tw = rw;
           }
 
-	         queue->tiles[y * htiles + x] = { x*tile_size, y*tile_size, tw, th };
+          tiles.push_back({ x*tile_size, y*tile_size, tw, th });
+          keys.push_back(key(o, x, y, htiles, vtiles));
         }
       }
 
+      std::vector<uint32_t> sorted(tiles.size());
+      for (auto i=0; i<sorted.size(); ++i) {
+        sorted[i] = i;
+      }
+
+      std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+        return keys[a] < keys[b];
+      });
+
+      auto queue = new tiles_t(workers(options), format);
+
+      queue->width  = width;
+      queue->height = height;
+
+      for (auto i : sorted) {
+        queue->all.push_back(tiles[i]);
+      }
+
+      queue->reset();
+
       return queue;
     }
+
+    /* hand out all tiles of the frame again. every thread gets a
+     * contiguous run of tiles along the curve. must not be called while
+     * threads take tiles */
+    inline void reset() {
+      for (auto& queue : queues) {
+        queue->tiles.clear();
+      }
+
+      const auto num = (uint32_t) queues.size();
+      for (auto i=0; i<all.size(); ++i) {
+        const auto worker = (uint32_t) (((uint64_t) i * num) / all.size());
+        queues[worker]->tiles.push_back(all[i]);
+      }
+
+      remaining = all.size();
+    }
+
+  private:
+
+    inline bool pop(uint32_t i, tile_t& out) {
+      auto& queue = *queues[i];
+
+      std::lock_guard<std::mutex> lock(queue.m);
+      if (queue.tiles.empty()) {
+        return false;
+      }
+
+      out = queue.tiles.front();
+      queue.tiles.pop_front();
+      --remaining;
+
+      return true;
+    }
+
+    /* take a tile from the back of another queue. if there are fewer
+     * tiles left than threads, the stolen tile gets split in half, and
+     * the other half goes to the front of the thief's queue */
+    inline bool steal(uint32_t victim, uint32_t thief, tile_t& out) {
+      {
+        auto& queue = *queues[victim];
+
+        std::lock_guard<std::mutex> lock(queue.m);
+        if (queue.tiles.empty()) {
+          return false;
+        }
+
+        out = queue.tiles.back();
+        queue.tiles.pop_back();
+        --remaining;
+      }
+
+      ++stolen;
+
+      tile_t rest;
+      if (remaining < queues.size() && split_tile(out, rest)) {
+        auto& queue = *queues[thief];
+
+        std::lock_guard<std::mutex> lock(queue.m);
+        queue.tiles.push_front(rest);
+        ++remaining;
+        ++split;
+      }
+
+      return true;
+    }
+
+    /* split a tile in half along its longer side */
+    static inline bool split_tile(tile_t& tile, tile_t& rest) {
+      if (tile.w >= tile.h && tile.w >= 2 * MIN_SPLIT_SIZE) {
+        const auto w = tile.w / 2;
+        rest = { tile.x + w, tile.y, tile.w - w, tile.h };
+        tile.w = w;
+        return true;
+      }
+      else if (tile.h >= 2 * MIN_SPLIT_SIZE) {
+        const auto h = tile.h / 2;
+        rest = { tile.x, tile.y + h, tile.w, tile.h - h };
+        tile.h = h;
+        return true;
+      }
+      return false;
+    }
+
+    /* position of a tile along the rendering order */
+    static inline uint32_t key(order_t o, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+      switch (o) {
+      case HILBERT:
+        {
+          auto n = 1u;
+          while (n < w || n < h) {
+            n *= 2;
+          }
+          return hilbert(n, x, y);
+        }
+      case SPIRAL:
+        return spiral(x, y, w, h);
+      default:
+        return y * w + x;
+      }
+    }
+
+    /* distance along a hilbert curve through a n * n grid, where n is a
+     * power of two */
+    static inline uint32_t hilbert(uint32_t n, uint32_t x, uint32_t y) {
+      uint32_t d = 0;
+
+      for (auto s=n/2; s>0; s/=2) {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+
+        d += s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant, so the curve continues in it
+        if (ry == 0) {
+          if (rx == 1) {
+            x = n-1 - x;
+            y = n-1 - y;
+          }
+          std::swap(x, y);
+        }
+      }
+
+      return d;
+    }
+
+    /* rings around the center of the image, and the angle within a
+     * ring. renders the center of the image first */
+    static inline uint32_t spiral(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+      const auto dx = (float) x - (w - 1) * 0.5f;
+      const auto dy = (float) y - (h - 1) * 0.5f;
+
+      const auto ring  = (uint32_t) std::max(std::fabs(dx), std::fabs(dy));
+      const auto angle = (std::atan2(dy, dx) + (float) M_PI) / (2.0f * (float) M_PI);
+
+      return (ring << 16) | std::min((uint32_t) (angle * 65535.0f), 65535u);
+    }
   };
 }
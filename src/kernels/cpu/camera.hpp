@@ -76,12 +76,35 @@ namespace camera {
   }
 
   struct perspective_kernel_t {
-    template<typename Tile, typename Samples, int N>
-    inline void operator()(
+    /* per camera constants, needed to generate rays */
+    struct setup_t {
+      simd::matrix44v_t m;
+      __m256 zoom;
+      __m256 stepx;
+      __m256 stepy;
+      __m256 ratio;
+
+      inline setup_t(const camera_t& camera)
+        : m(camera.to_world)
+        , zoom(simd::load(1.12f * std::tan(camera.fov * 0.5f)))
+        , stepx(simd::load(1.0f / (float)camera.film.width))
+        , stepy(simd::load(1.0f / (float)camera.film.height))
+        , ratio(simd::load((float)camera.film.width/(float)camera.film.height))
+      {}
+    };
+
+    /* rays through film positions sx, sy given in pixels, offset by
+     * film, and lens samples */
+    template<typename Sample>
+    static inline void generate(
         const camera_t& camera
-      , const Tile& tile
-      , const Samples& samples
-      , ray_t<N>* rays)
+      , const setup_t& setup
+      , const __m256& sx
+      , const __m256& sy
+      , const Sample& film_sample
+      , const Sample& lens_sample
+      , simd::vector3v_t& p
+      , simd::vector3v_t& d)
     {
       __aligned(32) static const float onev[] = {
         -1,-1,-1,-1,-1,-1,-1,-1
@@ -91,70 +114,116 @@ namespace camera {
         1,1,1,1,1,1,1,1
       };
 */
+      const auto zero  = simd::load(0.0f);
+      const auto half  = simd::load(0.5f);
+      const auto nhalf = simd::load(-0.5f);
+
+      const auto ndcy = half - (nhalf + sy) * setup.stepy;
+      const auto ndcx = (nhalf + sx) * setup.stepx - half;
+
+      p = simd::vector3v_t(0.0f, 0.0f, 0.0f);
+      d = simd::vector3v_t(film_sample.x, film_sample.y, onev);
+
+      d.x = (ndcx + d.x * setup.stepx) * setup.ratio * setup.zoom;
+      d.y = (ndcy + d.y * setup.stepy) * setup.zoom;
+
+      d.normalize();
+
+      if (!camera.is_pinhole()) {
+        const auto lens = sample_aperture(camera, lens_sample.stream());
+        const auto ft = simd::abs(simd::load(camera.focal_distance) / d.z);
+
+        p = simd::vector3v_t(lens.x, lens.y, zero);
+        d = (d * ft) - p;
+        d.normalize();
+      }
+
+      p = simd::transform_point(setup.m, p);
+      d = simd::transform_vector(setup.m, d);
+    }
+
+    template<typename Tile, typename Samples, int N>
+    inline void operator()(
+        const camera_t& camera
+      , const Tile& tile
+      , const Samples& samples
+      , ray_t<N>* rays)
+    {
       __aligned(32) static const float seqv[] = {
         0,1,2,3,4,5,6,7
       };
 
       const auto max  = simd::floatv_t(std::numeric_limits<float>::max());
 
-      const simd::matrix44v_t m(camera.to_world);
+      const setup_t setup(camera);
 
       const int32_t s = ray_t<N>::step;
 
       auto film_sample = samples.film;
       auto lens_sample = samples.lens;
 
-      const auto zero = simd::load(0.0f);
       const auto one  = simd::load(1.0f);
       auto step   = simd::load((float) s);
-      auto half   = simd::load(0.5f);
-      auto nhalf  = simd::load(-0.5f);
-
-      auto zoom = simd::load(1.12f * std::tan(camera.fov * 0.5f));
 
       auto px = simd::add(simd::load((float) tile.x), simd::load(seqv));
       auto py = simd::load((float) tile.y);
 
       auto off = 0;
 
-      const auto stepx = simd::load(1.0f / (float)camera.film.width);
-      const auto stepy = simd::load(1.0f / (float)camera.film.height);
-      const auto ratio = simd::load((float)camera.film.width/(float)camera.film.height);
-
       auto sy = py;
       for (auto y=0; y<tile.h; ++y) {
-        const auto ndcy = half - (nhalf + sy) * stepy;
         auto sx = px;
 
         for (auto x=0; x<tile.w; x+=s, ++film_sample, ++lens_sample, off+=s) {
-          const auto ndcx = (nhalf + sx) * stepx - half;
+          simd::vector3v_t p, d;
+          generate(camera, setup, sx, sy, *film_sample, *lens_sample, p, d);
+          
+          rays->reset(off, p, d, max, simd::int32v_t(0));
 
-          simd::vector3v_t p(0.0f, 0.0f, 0.0f);
-          simd::vector3v_t d(film_sample->x, film_sample->y, onev);
+          sx = simd::add(sx, step);
+        }
 
-          d.x = (ndcx + d.x * stepx) * ratio * zoom;
-          d.y = (ndcy + d.y * stepy) * zoom;
+        sy = simd::add(sy, one);
+      }
+    }
+
+    /* rays for a list of film pixels 'px', 'py', which get stored in
+     * the ray stream starting at 'first'. this is used to start new
+     * paths in the free slots of a stream, so 'first' doesn't need to
+     * be aligned to the simd width. the pixel lists must be padded to
+     * a multiple of the simd width */
+    template<typename Samples, int N>
+    inline void operator()(
+        const camera_t& camera
+      , const float* px
+      , const float* py
+      , const Samples& samples
+      , uint32_t num
+      , ray_t<N>* rays
+      , uint32_t first)
+    {
+      const int32_t s = ray_t<N>::step;
 
-          d.normalize();
+      const setup_t setup(camera);
 
-          if (!camera.is_pinhole()) {
-            const auto lens = sample_aperture(camera, lens_sample->stream());
-            const auto ft = simd::abs(simd::load(camera.focal_distance) / d.z);
+      __aligned(32) float p[3][s];
+      __aligned(32) float d[3][s];
 
-            p = simd::vector3v_t(lens.x, lens.y, zero);
-            d = (d * ft) - p;
-            d.normalize();
-          }
+      for (auto i=0, k=0; i<num; i+=s, ++k) {
+        simd::vector3v_t vp, vd;
+        generate(
+          camera, setup, simd::load(px + i), simd::load(py + i)
+        , samples.film[k], samples.lens[k], vp, vd);
 
-          p = simd::transform_point(m, p);
-          d = simd::transform_vector(m, d);
-          
-          rays->reset(off, p, d, max, simd::int32v_t(0));
+        simd::store(vp.x, p[0]); simd::store(vp.y, p[1]); simd::store(vp.z, p[2]);
+        simd::store(vd.x, d[0]); simd::store(vd.y, d[1]); simd::store(vd.z, d[2]);
 
-          sx = simd::add(sx, step);
+        for (auto j=0; j<s && i+j<num; ++j) {
+          rays->reset(
+            first + i + j
+          , Imath::V3f(p[0][j], p[1][j], p[2][j])
+          , Imath::V3f(d[0][j], d[1][j], d[2][j]));
         }
-
-        sy = simd::add(sy, one);
       }
     }
   };
@@ -5,11 +5,37 @@
 #include "utils/allocator.hpp"
 #include "utils/assert.hpp"
 
+#include <chrono>
+
 struct deferred_shading_kernel_t {
+  /* shading statistics, collected over the lifetime of a kernel */
+  struct stats_t {
+    // number of hit points shaded, and the number of batches they
+    // were shaded in
+    uint64_t points;
+    uint64_t batches;
+    // time spent in the material system
+    uint64_t nanoseconds;
+
+    inline stats_t()
+      : points(0), batches(0), nanoseconds(0)
+    {}
+
+    inline void add(const stats_t& other) {
+      points      += other.points;
+      batches     += other.batches;
+      nanoseconds += other.nanoseconds;
+    }
+  };
+
   struct deferred_t {
     active_t<>* material;
     uint32_t    size;
 
+    inline deferred_t()
+      : material(nullptr), size(0)
+    {}
+
     inline deferred_t(allocator_t& allocator, uint32_t size)
       : size(size)
     {
@@ -17,23 +43,55 @@ struct deferred_shading_kernel_t {
     }
   };
 
+  // shade all hit points of a material at once, or one point at a time
+  bool batched;
+
+  stats_t stats;
+
+  // hit points of the last shaded path segment, by material. these live
+  // in the allocator, until the segment is cleared
+  deferred_t buckets;
+
+  inline deferred_shading_kernel_t(bool batched = true)
+    : batched(batched)
+  {}
+
   inline void operator()(
     allocator_t& allocator
   , const scene_t& scene
   , const active_t<>& active
   , const ray_t<>* rays
-  , interaction_t<>* hits) const
+  , interaction_t<>* hits)
   {
-    deferred_t by_material(allocator, scene.num_materials());
-    build_interactions(scene, active, rays, hits, by_material);
+    buckets = deferred_t(allocator, scene.num_materials());
+    build_interactions(scene, active, rays, hits, buckets);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (auto i=0; i<buckets.size; ++i) {
+      const auto  material = scene.material(i);
+      const auto& bucket   = buckets.material[i];
+
+      if (bucket.num == 0) {
+        continue;
+      }
+
+      if (batched) {
+        material->evaluate(allocator, hits, bucket);
+        ++stats.batches;
+      }
+      else {
+        for (auto j=0; j<bucket.num; ++j) {
+          material->evaluate(allocator, hits, bucket.index[j]);
+        }
+        stats.batches += bucket.num;
+      }
 
-    for (auto i=0; i<by_material.size; ++i) {
-      const auto material = scene.material(i);
-      material->evaluate(allocator, hits, by_material.material[i]);
+      stats.points += bucket.num;
     }
 
-    // TODO: copy deferred buckets back into the active set?
-    // this could be helpful for integration
+    stats.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
   }
 
   void build_interactions(
@@ -45,6 +103,8 @@ struct deferred_shading_kernel_t {
   {
     for (auto i=0; i<active.num; ++i) {
       hits->flags[i] = rays->flags[i];
+      hits->mesh[i]  = rays->is_hit(i) ? rays->mesh[i] : ENVIRONMENT;
+      hits->face[i]  = rays->is_hit(i) ? rays->face[i] : 0;
 
       const auto p = rays->p.at(i);
       const auto wi = rays->wi.at(i);
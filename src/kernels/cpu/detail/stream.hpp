@@ -3,24 +3,46 @@
 #include "state.hpp"
 #include "utils/assert.hpp"
 
-namespace stream {
-  static const uint32_t RAYS_PER_LANE = (2<<17)-1;
+#include <algorithm>
+#include <vector>
 
+namespace stream {
   struct node_ref_t {
     uint32_t offset : 28;
     uint32_t flags  : 4;
     float    d;
   };
 
+  /* Ray ids waiting for the children of visited nodes, one lane per
+   * child slot. Lanes are used like stacks. A task pops its rays before
+   * the children of its node push theirs, so a lane holds at most one
+   * block of rays per level of the tree on the current traversal path,
+   * and each block has at most as many rays as the stream. Lanes are
+   * sized from that bound, and live back to back in one allocation */
   template<int WIDTH>
   struct lanes_t {
-    uint32_t active[WIDTH][RAYS_PER_LANE];
+    uint32_t* active[WIDTH];
     uint32_t num[WIDTH];
+    // number of rays each lane has room for
+    uint32_t capacity;
+
+    std::vector<uint32_t> storage;
 
-    inline lanes_t() {
+    inline lanes_t(uint32_t stream_size, uint32_t depth)
+      : capacity(stream_size * std::max(depth, 1u))
+      , storage((size_t) WIDTH * capacity)
+    {
+      for (auto i=0; i<WIDTH; ++i) {
+        active[i] = storage.data() + (size_t) i * capacity;
+      }
       memset(num, 0, sizeof(uint32_t) * WIDTH);
     }
 
+    /* bytes of ray ids held by all lanes */
+    inline size_t size() const {
+      return storage.size() * sizeof(uint32_t);
+    }
+
     template<typename T>
     inline void init(const active_t<>& a, const T* stream) {
       num[0] = 0;
@@ -88,7 +110,7 @@ namespace stream {
     stack[top].offset   = node.offset[lane];
     stack[top].num_rays = num;
     stack[top].lane     = lane;
-    stack[top].flags    = node.flags[lane];
+    stack[top].flags    = node.is_leaf(lane) ? 1 : 0;
     stack[top].prims    = node.num[lane];
 
     ++top;
@@ -96,7 +118,7 @@ namespace stream {
 
   template<int WIDTH>
   inline void push(lanes_t<WIDTH>& lanes, uint8_t lane, uint32_t id) {
-    assert(lanes.num[lane] < RAYS_PER_LANE);
+    assert(lanes.num[lane] < lanes.capacity);
 
     auto& a = lanes.num[lane];
     lanes.active[lane][a++] = id;
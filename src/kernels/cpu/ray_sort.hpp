@@ -0,0 +1,152 @@
+#pragma once
+
+#include "state.hpp"
+#include "utils/allocator.hpp"
+
+#include <ImathBox.h>
+
+#include <algorithm>
+#include <string.h>
+
+/**
+ * Reorders the rays in the pipeline, so rays with similar directions and
+ * origins end up next to each other. Rays are sorted by the octant of
+ * their direction first, and by the morton code of their origin inside
+ * the scene bounds second. This helps keeping the lanes in the stream
+ * traversal coherent after the first bounce
+ */
+struct ray_sort_kernel_t {
+  // bits per axis of the morton code
+  static const uint32_t MORTON_BITS = 10;
+  // bits used to store the index of a ray next to its key
+  static const uint32_t INDEX_BITS = 10;
+  // bits sorted per radix sort pass
+  static const uint32_t RADIX_BITS = 11;
+  static const uint32_t RADIX = 1 << RADIX_BITS;
+
+  static_assert((1 << INDEX_BITS) >= config::STREAM_SIZE, "Stream too large for ray keys");
+
+  Imath::Box3f bounds;
+  Imath::V3f   scale;
+
+  inline ray_sort_kernel_t(const Imath::Box3f& bounds)
+    : bounds(bounds)
+  {
+    const auto size = bounds.max - bounds.min;
+    for (auto i=0; i<3; ++i) {
+      scale[i] = size[i] > 0.0f ? ((1 << MORTON_BITS) - 1) / size[i] : 0.0f;
+    }
+  }
+
+  static inline uint64_t spread(uint64_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x <<  8)) & 0x300f00f;
+    x = (x | (x <<  4)) & 0x30c30c3;
+    x = (x | (x <<  2)) & 0x9249249;
+    return x;
+  }
+
+  inline uint64_t morton(const Imath::V3f& p) const {
+    uint64_t code = 0;
+    for (auto i=0; i<3; ++i) {
+      const auto x = (p[i] - bounds.min[i]) * scale[i];
+      const auto q = (uint64_t) std::max(0.0f, std::min(x, (float) ((1 << MORTON_BITS) - 1)));
+      code |= spread(q) << (2-i);
+    }
+    return code;
+  }
+
+  inline uint64_t key(const ray_t<>* rays, uint32_t i) const {
+    const auto wi = rays->wi.at(i);
+
+    const uint64_t octant =
+      (wi.x < 0.0f ? 4 : 0) |
+      (wi.y < 0.0f ? 2 : 0) |
+      (wi.z < 0.0f ? 1 : 0);
+
+    const auto code = (octant << (3*MORTON_BITS)) | morton(rays->p.at(i));
+
+    return (code << INDEX_BITS) | i;
+  }
+
+  inline void operator()(
+    allocator_t& allocator
+  , active_t<>& active
+  , ray_t<>* rays) const
+  {
+    const auto num = active.num;
+
+    if (num < 2) {
+      return;
+    }
+
+    auto* keys = new(allocator) uint64_t[num];
+    auto* tmp  = new(allocator) uint64_t[num];
+    auto* hist = new(allocator) uint32_t[RADIX];
+
+    for (auto i=0; i<num; ++i) {
+      keys[i] = key(rays, i);
+    }
+
+    // LSD radix sort, over the bits above the ray indices
+    const auto bits = 3 + 3*MORTON_BITS;
+    for (auto shift=INDEX_BITS; shift<INDEX_BITS+bits; shift+=RADIX_BITS) {
+      memset(hist, 0, sizeof(uint32_t) * RADIX);
+
+      for (auto i=0; i<num; ++i) {
+        ++hist[(keys[i] >> shift) & (RADIX-1)];
+      }
+
+      auto sum = 0u;
+      for (auto i=0; i<RADIX; ++i) {
+        const auto count = hist[i];
+        hist[i] = sum;
+        sum += count;
+      }
+
+      for (auto i=0; i<num; ++i) {
+        tmp[hist[(keys[i] >> shift) & (RADIX-1)]++] = keys[i];
+      }
+
+      std::swap(keys, tmp);
+    }
+
+    permute(allocator, active, rays, keys);
+  }
+
+  /* move rays, and their path indices into sorted order. only the
+   * state of rays that haven't been traced yet needs to move */
+  inline void permute(
+    allocator_t& allocator
+  , active_t<>& active
+  , ray_t<>* rays
+  , const uint64_t* keys) const
+  {
+    auto* sorted = new(allocator) ray_t<>();
+    auto* index  = new(allocator) uint32_t[active.num];
+
+    for (auto i=0; i<active.num; ++i) {
+      const auto from = keys[i] & ((1 << INDEX_BITS) - 1);
+
+      sorted->p.from(i, rays->p.at(from));
+      sorted->wi.from(i, rays->wi.at(from));
+      sorted->d[i]     = rays->d[from];
+      sorted->flags[i] = rays->flags[from];
+
+      index[i] = active.index[from];
+    }
+
+    const auto bytes = sizeof(float) * active.num;
+
+    memcpy(rays->p.x, sorted->p.x, bytes);
+    memcpy(rays->p.y, sorted->p.y, bytes);
+    memcpy(rays->p.z, sorted->p.z, bytes);
+    memcpy(rays->wi.x, sorted->wi.x, bytes);
+    memcpy(rays->wi.y, sorted->wi.y, bytes);
+    memcpy(rays->wi.z, sorted->wi.z, bytes);
+    memcpy(rays->d, sorted->d, bytes);
+    memcpy(rays->flags, sorted->flags, bytes);
+    memcpy(active.index, index, bytes);
+  }
+};
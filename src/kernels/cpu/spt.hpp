@@ -3,6 +3,7 @@
 #include "light.hpp"
 #include "state.hpp"
 #include "../../bsdf.hpp"
+#include "bsdf/packet.hpp"
 #include "math/vector.hpp"
 
 #include <cmath>
@@ -11,105 +12,125 @@
  * Path tracing integrator
  *
  * This integrator implemtns path tracing over a path over samples
- * in parallel. All paths are uni directional starting at the camera
- *
- * FIXME: path revival is broken at the moment. the color of the first
- * intersection is not kept, and so additional paths will darken the image.
- * this code could probably use a complete rewrite
+ * in parallel. All paths are uni directional starting at the camera.
+ * Paths are identified by an index into the integrator state. When a
+ * path terminates its index gets marked as finished, so the renderer
+ * can collect its radiance, and start a new path with it
  */
 namespace spt {
+  /* weight of a sample drawn with pdf 'a' when combining it with
+   * samples drawn from another distribution with pdf 'b' */
+  inline float power_heuristic(float a, float b) {
+    const auto a2 = a * a;
+    const auto b2 = b * b;
+    return a2 > 0.0f ? a2 / (a2 + b2) : 0.0f;
+  }
+
   /* This stores some state needed by the path integrator */
   template<int N = 1024>
   struct state_t {
     const scene_t* scene;
     sampler_t* sampler;
+    // the film pixel a path at an index belongs to
+    uint32_t pixel[N];
+    // the pixel in the current tile a path at an index belongs to
+    uint32_t tile_pixel[N];
+    // the sample of its pixel, a path at an index computes
+    uint32_t sample[N];
 
     uint16_t depth[N];      // the current depth of the path at an index
-    uint16_t path[N];       // the number of paths traced at index
     float pdf[N];           // a pdf for a light sample at an index
+    float bsdf_pdf[N];      // the pdf of the last sampled path direction
+    soa::vector3_t<N> last_p; // the vertex the last direction was sampled at
+    soa::vector3_t<N> last_n; // and its normal
     soa::vector3_t<N> beta; // the contribution of the current path vertex
-    soa::vector3_t<N> r;    // accumulated radiance over all computed paths
+    soa::vector3_t<N> r;    // accumulated radiance of the path at an index
 
-    active_t<> dead;
+    // the bsdf at the hit point at a stream position, evaluated for the
+    // direction of its light sample, and the pdf of sampling that
+    // direction with the bsdf instead
+    soa::vector3_t<N> light_f;
+    float light_bsdf_pdf[N];
+
+    // paths that terminated since they were last collected
+    active_t<N> finished;
 
     inline state_t(const scene_t* scene, sampler_t* sampler)
       : scene(scene), sampler(sampler)
     {}
 
-    inline void reset() {
-      memset(depth, 0, sizeof(depth));
-      memset(path, 0, sizeof(path));
-      memset(&r, 0, sizeof(r));
-
-      for (auto i=0; i<N; ++i) {
-        beta.from(i, Imath::V3f(1.0f));
-      }
-
-      dead.clear();
+    /* a 2d sample, for a dimension of a vertex of the path at an index */
+    inline Imath::V2f sample2(uint32_t index, uint32_t vertex, uint32_t dimension) {
+      return sampler->sample2(
+        pixel[index]
+      , sample[index]
+      , sampling::dimension::vertex(vertex, dimension));
     }
 
     inline decltype(auto) next_light_samples() {
       return sampler->next_light_samples();
     }
 
-    inline void mark_for_revive(uint32_t i) {
-      dead.add(i);
-    }
-
-    inline void revive(uint32_t i) {
+    /* start a new path at an index */
+    inline void start(uint32_t i, uint32_t _pixel, uint32_t _tile_pixel, uint32_t _sample) {
+      pixel[i] = _pixel;
+      tile_pixel[i] = _tile_pixel;
+      sample[i] = _sample;
       depth[i] = 0;
-      path[i]++;
       beta.from(i, Imath::V3f(1.0f));
+      r.from(i, Imath::V3f(0.0f));
+    }
+
+    inline void finish(uint32_t i) {
+      finished.add(i);
     }
   };
 
   struct light_sampler_t {
-    uint32_t paths_per_sample;
-
     inline light_sampler_t(const parsed_options_t& options)
-      : paths_per_sample(options.paths_per_sample)
     {}
 
-    inline void revive_dead_paths(
-      state_t<>* state
-    , active_t<>& active 
-    , const interaction_t<>* primary
-    , interaction_t<>* hits) const
-    {
-      assert(active.num + state->dead.num <= active_t<>::size);
-
-      for (auto i=0; i<state->dead.num; ++i) {
-        const auto pixel = state->dead.index[i];
-        const auto index = active.num;
-
-        if (primary->is_hit(pixel)) {
-          hits->from(primary, pixel, index);
-          state->revive(pixel);
-          active.add(pixel);
-        }
-      }
-
-      state->dead.clear();
-    }
-
     inline void operator()(
       state_t<>* state
     , active_t<>& active
-    , const interaction_t<>* primary
     , interaction_t<>* hits
     , ray_t<>* rays) const
     {
-      // mark dead paths as alive, so we can generate new shadow rays
-      // for these paths
-      revive_dead_paths(state, active, primary, hits);
-
       const auto hit    = simd::int32v_t(HIT);
       const auto masked = simd::int32v_t(MASKED | SHADOW);
       const auto shadow = simd::int32v_t(SHADOW);
 
       sampler_t::light_samples_t light_samples;
 
-      state->sampler->fresh_light_samples(state->scene, light_samples);
+      // sample lights for all paths, and pad the last packet of paths
+      // with valid samples
+      const auto num = (active.num + SIMD_WIDTH - 1) & ~(SIMD_WIDTH - 1);
+
+      float select[sampler_t::light_samples_t::size];
+      Imath::V2f uv[sampler_t::light_samples_t::size];
+      Imath::V3f p[sampler_t::light_samples_t::size];
+      Imath::V3f n[sampler_t::light_samples_t::size];
+
+      for (auto i=0; i<num; ++i) {
+        if (i < active.num) {
+          const auto index  = active.index[i];
+          const auto vertex = state->depth[index];
+
+          select[i] = state->sample2(index, vertex, sampling::dimension::SELECT).x;
+          uv[i]     = state->sample2(index, vertex, sampling::dimension::LIGHT);
+          p[i]      = hits->p.at(i);
+          n[i]      = hits->n.at(i);
+        }
+        else {
+          select[i] = 0.5f;
+          uv[i]     = Imath::V2f(0.5f);
+          p[i]      = Imath::V3f(0.0f);
+          n[i]      = Imath::V3f(0.0f, 0.0f, 1.0f);
+        }
+      }
+
+      state->sampler->fresh_light_samples(
+        state->scene, select, uv, p, n, num, light_samples);
       const auto* samples = light_samples.samples;
 
       // iterate over alls paths, and generate shadow rays for them
@@ -142,6 +163,13 @@ namespace spt {
 
         rays->reset(i, p, wi, d, flags);
 
+        // samples that can't contribute don't need a shadow ray
+        for (auto k=0; k<SIMD_WIDTH; ++k) {
+          if (!(samples->pdf[k] > 0.0f)) {
+            rays->mask(i + k);
+          }
+        }
+
         // we store the pdfs for the light samples in the integrator
         // state, since we need them later on
         simd::floatv_t(samples->pdf).storeu(state->pdf, i);
@@ -151,20 +179,27 @@ namespace spt {
 
   struct integrator_t {
     uint32_t max_depth;
-    uint32_t paths_per_sample;
+    // evaluate bsdfs for light samples in simd packets, per material
+    bool packets;
 
     integrator_t(const parsed_options_t& options)
       : max_depth(options.path_depth)
-      , paths_per_sample(options.paths_per_sample)
+      , packets(options.packet_bsdfs)
     {}
 
+    /* advance all paths by one vertex. 'by_material' holds the
+     * stream positions of the hits of every material, as they were
+     * shaded. without it, bsdfs are evaluated one hit at a time */
     inline void operator()(
       state_t<>* state
     , active_t<>& active
-    , interaction_t<>* primary
     , interaction_t<>* hits
-    , ray_t<>* samples) const
+    , ray_t<>* samples
+    , const active_t<>* by_material = nullptr
+    , uint32_t num_materials = 0) const
     {
+      evaluate_light_samples(state, hits, samples, active.num, by_material, num_materials);
+
       const auto num = active.clear();
 
       for (auto i=0; i<num; ++i) {
@@ -173,10 +208,14 @@ namespace spt {
         auto out = state->r.at(index);
 
         if (hits->is_hit(i)) {
-          // add direct lighting to path vertex
+          // add direct lighting to path vertex. emitters found by
+          // sampling a bsdf, could have been light sampled as well
           if (state->depth[index] == 0 || hits->is_specular(i)) {
             out += state->beta.at(index) * hits->e.at(i);
           }
+          else if (!color::is_black(hits->e.at(i))) {
+            out += state->beta.at(index) * hits->e.at(i) * bsdf_weight(state, hits, index, i);
+          }
 
           // compute direct light contribution at the current
           // path vertex. this gets modulated by the current path weight
@@ -191,24 +230,191 @@ namespace spt {
           if (sample_bsdf(state, hits, samples, index, i, active.num)) {
             active.add(index);
           }
-
-          // else if ((state->path[index]+1) < paths_per_sample) {
-          //   state->mark_for_revive(index);
-          // }
+          else {
+            state->finish(index);
+          }
         }
         else {
           // add environment lighting
-          out += state->beta.at(index) * hits->e.at(i);
+          if (state->depth[index] == 0 || hits->is_specular(i)) {
+            out += state->beta.at(index) * hits->e.at(i);
+          }
+          else if (!color::is_black(hits->e.at(i))) {
+            out += state->beta.at(index) * hits->e.at(i) * bsdf_weight(state, hits, index, i);
+          }
 
-          // if ((state->path[index]+1) < paths_per_sample) {
-          //   state->mark_for_revive(index);
-          // }
+          state->finish(index);
         }
 
         state->r.from(index, out);
       }
     }
 
+    /* multiple importance sampling weight of emission, that was found
+     * by following a direction sampled from the bsdf at the previous
+     * path vertex */
+    inline float bsdf_weight(
+      state_t<>* state
+    , const interaction_t<>* hits
+    , uint32_t index
+    , uint32_t i) const
+    {
+      const auto scene = state->scene;
+      const auto from  = state->last_p.at(index);
+      const auto n     = state->last_n.at(index);
+
+      const light_t* light;
+      float light_pdf;
+
+      if (hits->is_hit(i)) {
+        light = scene->emitter(hits->meshid(i), hits->face[i]);
+        if (!light) {
+          // emitters that aren't lights can't be light sampled
+          return 1.0f;
+        }
+        light_pdf = light->pdf(from, hits->p.at(i), hits->n.at(i));
+      }
+      else {
+        light = scene->environment();
+        if (!light) {
+          return 1.0f;
+        }
+        light_pdf = light->pdf(hits->wi.at(i));
+      }
+
+      light_pdf *= state->sampler->light_pdf(scene, from, n, light);
+
+      return power_heuristic(state->bsdf_pdf[index], light_pdf);
+    }
+
+    /* evaluate the bsdfs of all hits for the directions of their
+     * light samples. hits of the same material mostly have the same
+     * lobes, so they get evaluated SIMD_WIDTH hits at a time */
+    inline void evaluate_light_samples(
+      state_t<>* state
+    , const interaction_t<>* hits
+    , const ray_t<>* samples
+    , uint32_t num
+    , const active_t<>* by_material
+    , uint32_t num_materials) const
+    {
+      if (!packets || !by_material) {
+        for (auto i=0; i<num; ++i) {
+          if (needs_light_sample(hits, samples, i)) {
+            evaluate_light_sample(state, hits, samples, i);
+          }
+        }
+        return;
+      }
+
+      const bsdf_t* bsdfs[bsdf::packet_t::width];
+      uint32_t at[bsdf::packet_t::width];
+
+      for (auto m=0; m<num_materials; ++m) {
+        const auto& bucket = by_material[m];
+
+        auto n = 0u;
+        for (auto j=0; j<bucket.num; ++j) {
+          const auto i = bucket.index[j];
+
+          if (!needs_light_sample(hits, samples, i)) {
+            continue;
+          }
+
+          const auto candidate = hits->bsdf[i];
+
+          if (!bsdf::packet_t::is_supported(candidate)) {
+            evaluate_light_sample(state, hits, samples, i);
+            continue;
+          }
+
+          if (n > 0 && !bsdf::packet_t::matches(bsdfs[0], candidate)) {
+            evaluate_light_samples(state, hits, samples, bsdfs, at, n);
+            n = 0;
+          }
+
+          bsdfs[n] = candidate;
+          at[n++]  = i;
+
+          if (n == bsdf::packet_t::width) {
+            evaluate_light_samples(state, hits, samples, bsdfs, at, n);
+            n = 0;
+          }
+        }
+
+        if (n > 0) {
+          evaluate_light_samples(state, hits, samples, bsdfs, at, n);
+        }
+      }
+    }
+
+    /* evaluate a packet of matching bsdfs, at the stream positions 'at' */
+    inline void evaluate_light_samples(
+      state_t<>* state
+    , const interaction_t<>* hits
+    , const ray_t<>* samples
+    , const bsdf_t* const* bsdfs
+    , const uint32_t* at
+    , uint32_t num) const
+    {
+      static const auto width = bsdf::packet_t::width;
+
+      alignas(32) float wix[width], wiy[width], wiz[width];
+      alignas(32) float wox[width], woy[width], woz[width];
+
+      for (auto lane=0u; lane<width; ++lane) {
+        const auto i = at[lane < num ? lane : 0];
+
+        wix[lane] = samples->wi.x[i];
+        wiy[lane] = samples->wi.y[i];
+        wiz[lane] = samples->wi.z[i];
+
+        wox[lane] = hits->wi.x[i];
+        woy[lane] = hits->wi.y[i];
+        woz[lane] = hits->wi.z[i];
+      }
+
+      const simd::vector3v_t wi(wix, wiy, wiz);
+      const simd::vector3v_t wo(wox, woy, woz);
+
+      bsdf::packet_t packet;
+      packet.load(bsdfs, num);
+
+      alignas(32) float fx[width], fy[width], fz[width], pdf[width];
+      packet.f(wi, wo).store(fx, fy, fz);
+      packet.pdf(wo, wi).store(pdf);
+
+      for (auto lane=0u; lane<num; ++lane) {
+        const auto i = at[lane];
+
+        state->light_f.from(i, Imath::V3f(fx[lane], fy[lane], fz[lane]));
+        state->light_bsdf_pdf[i] = pdf[lane];
+      }
+    }
+
+    inline void evaluate_light_sample(
+      state_t<>* state
+    , const interaction_t<>* hits
+    , const ray_t<>* samples
+    , uint32_t i) const
+    {
+      const auto bsdf = hits->bsdf[i];
+      const auto wi   = samples->wi.at(i);
+      const auto wo   = hits->wi.at(i);
+
+      state->light_f.from(i, bsdf->f(wi, wo));
+      state->light_bsdf_pdf[i] = bsdf->pdf(wo, wi);
+    }
+
+    /* the light sample of a hit contributes to its path */
+    inline bool needs_light_sample(
+      const interaction_t<>* hits
+    , const ray_t<>* samples
+    , uint32_t i) const
+    {
+      return hits->is_hit(i) && !samples->is_occluded(i) && hits->bsdf[i];
+    }
+
     Imath::Color3f li(
       state_t<>* state 
     , ray_t<>* samples
@@ -232,7 +438,23 @@ namespace spt {
         return Imath::Color3f(0.0f);
       }
 
-      const auto f = bsdf->f(wi, wo);
+      // the bsdf was evaluated for the light sample up front, together
+      // with the probability of sampling the light with the bsdf instead
+      const auto f        = state->light_f.at(to);
+      const auto bsdf_pdf = state->light_bsdf_pdf[to];
+
+      // radiance from the environment is looked up in the baked map,
+      // and its pdf is already with respect to solid angle
+      if (samples->is_environment(to)) {
+        const auto env = state->scene->environment();
+        const auto pdf = state->pdf[to];
+
+        if (!env || pdf <= 0.0f) {
+          return Imath::Color3f(0.0f);
+        }
+
+        return env->eval(wi) * f * (power_heuristic(pdf, bsdf_pdf) / pdf);
+      }
 
       const auto mesh = state->scene->mesh(samples->meshid(to));
       const auto material = state->scene->material(samples->matid(to));
@@ -246,12 +468,26 @@ namespace spt {
       shading_result_t light;
       {
         mesh->shading_parameters(samples, light_n, light_st, _base, to);
-        material->evaluate(p, wi, light_n, light_st, light);
+
+        // lights bake emission that doesn't depend on the view
+        const auto emitter = state->scene->emitter(samples->meshid(to), samples->face[to]);
+
+        Imath::Color3f e;
+        if (emitter && emitter->emission(light_st, e)) {
+          light.e = e;
+        }
+        else {
+          material->evaluate(p, wi, light_n, light_st, light);
+        }
       }
 
       const auto pdf = state->pdf[to] * d * d / std::fabs(light_n.dot(-wi));
 
-      return (light.e * 4) * f * (1.0f / pdf);
+      if (!(pdf > 0.0f) || std::isinf(pdf)) {
+        return Imath::Color3f(0.0f);
+      }
+
+      return light.e * f * (power_heuristic(pdf, bsdf_pdf) / pdf);
     }
 
     bool sample_bsdf(
@@ -285,7 +521,9 @@ namespace spt {
       uint32_t flags;
       float pdf;
       Imath::V3f sampled;
-      Imath::V2f sample = state->sampler->sample2();
+      // the path depth was already advanced past the current vertex
+      Imath::V2f sample = state->sample2(
+        index, state->depth[index] - 1, sampling::dimension::BSDF);
 
       // sample the bsdf based on the previous path direction
       const auto f = bsdf->sample(sample, wi, sampled, pdf, flags);
@@ -298,6 +536,10 @@ namespace spt {
 
       state->beta.from(index, beta * (f * (std::fabs(weight) / pdf)));
 
+      state->bsdf_pdf[index] = pdf;
+      state->last_p.from(index, p);
+      state->last_n.from(index, n);
+
       rays->reset(to, offset(p, n, weight < 0.0f), sampled);
       rays->specular_bounce(to, bsdf_t::is_specular(flags));
 
@@ -315,7 +557,8 @@ namespace spt {
       if (alive) {
         if (state->depth[index] >= 3) {
           float q = std::max((float) 0.05f, 1.0f - color::y(beta));
-          alive = state->sampler->sample() >= q;
+          const auto vertex = state->depth[index] - 1;
+          alive = state->sample2(index, vertex, sampling::dimension::SELECT).y >= q;
           if (alive) {
             w = (1.0f / (1.0f - q));
           }
@@ -10,16 +10,139 @@
 struct stream_mbvh_kernel_t::details_t{
   stream::lanes_t<accel::mbvh_t::width> lanes;
   stream::task_t tasks[256];
+  stream::node_ref_t stack[256];
+
+  stream_mbvh_kernel_t::stats_t stats;
+
+  inline details_t(const accel::mbvh_t* bvh)
+    : lanes(active_t<>::size, bvh->depth)
+  {
+    stats.lane_bytes = lanes.size();
+  }
 };
 
+/* child bounds of a node, ready to be tested against rays */
+template<int N>
+inline simd::aabb_t<N> decode(const mbvh::node_t<N>& node) {
+  return simd::aabb_t<N>(node.bounds);
+}
+
+template<int N>
+inline simd::aabb_t<N> decode(const mbvh::compressed_node_t<N>& node) {
+  return simd::aabb_t<N>(
+    simd::quantized_aabb_t<N>(node.bounds, node.origin, node.scale));
+}
+
+/* traverse the sub tree below a node with a single ray. children get
+ * visited front to back, leaves are tested as soon as they are hit, and
+ * nodes behind the closest hit found so far are skipped. returns the
+ * number of visited nodes */
+template<bool Occlusion, typename Stream, typename Node>
+uint64_t intersect_single(
+  stream::node_ref_t* stack
+  , Stream* stream
+  , uint32_t ray
+  , const accel::mbvh_t* bvh
+  , const Node* nodes
+  , uint32_t root)
+{
+  typedef simd::float_t<accel::mbvh_t::width> float_t;
+
+  const auto o   = stream->p.v_at(ray);
+  const auto ood = stream->wi.v_at(ray).rcp();
+
+  uint64_t visited = 0;
+
+  auto top = 0;
+  stack[top].offset = root;
+  stack[top].flags  = 0;
+  stack[top].d      = 0.0f;
+  ++top;
+
+  while (top > 0) {
+    const auto ref = stack[--top];
+
+    if (Occlusion && stream->is_hit(ray)) {
+      break;
+    }
+
+    if (ref.d > stream->d[ray]) {
+      continue;
+    }
+
+    const auto& node = nodes[ref.offset];
+
+    ++visited;
+
+    __aligned(64) const simd::aabb_t<accel::mbvh_t::width> bounds(decode(node));
+
+    float_t dist;
+    const auto hits =
+      simd::intersect<accel::mbvh_t::width>(
+        bounds, o, ood, stream->d[ray], dist);
+
+    auto mask = simd::to_mask(hits);
+
+    if (mask == 0) {
+      continue;
+    }
+
+    __aligned(32) float dists[8];
+    dist.store(dists);
+
+    // sort hit children front to back
+    uint32_t ids[8];
+    auto n = 0;
+    while (mask != 0) {
+      const auto x = __bscf(mask);
+      auto j = n++;
+      for (; j>0 && dists[x] < dists[ids[j-1]]; --j) {
+        ids[j] = ids[j-1];
+      }
+      ids[j] = x;
+    }
+
+    for (auto i=0; i<n; ++i) {
+      const auto x = ids[i];
+
+      if (!node.is_leaf(x)) {
+        continue;
+      }
+
+      auto index = node.offset[x];
+      for (auto prims=0; prims<node.num[x]; prims+=accel::mbvh_t::width, ++index) {
+        if (Occlusion) {
+          bvh->triangles[index].occluded_rays(stream, &ray, 1);
+        }
+        else {
+          bvh->triangles[index].iterate_rays(stream, &ray, 1);
+        }
+      }
+    }
+
+    // push far nodes first, so the closest gets visited next
+    for (auto i=n-1; i>=0; --i) {
+      if (!node.is_leaf(ids[i])) {
+        stream::push(stack, top, dists, &node, ids[i]);
+      }
+    }
+  }
+
+  return visited;
+}
+
 /* Implements MBVH-RS algorithm for tracing a set of rays through 
- * the scene */
-template<typename Stream>
+ * the scene. With 'Occlusion' set, rays are only tested for any
+ * intersection. they leave the traversal on their first hit, children
+ * are visited in any order, and no surface data gets written */
+template<bool Occlusion, typename Stream, typename Node>
 void intersect(
   stream_mbvh_kernel_t::details_t* state
   , Stream* stream
   , const active_t<>& active
-  , const accel::mbvh_t* bvh)
+  , const accel::mbvh_t* bvh
+  , const Node* nodes
+  , uint32_t threshold)
 {
   typedef simd::float_t<accel::mbvh_t::width> float_t;
 
@@ -34,6 +157,11 @@ void intersect(
     return;
   }
 
+  state->stats.rays += lanes.num[0];
+  ++state->stats.streams;
+
+  uint64_t visited = 0;
+
   const float_t zero(0.0f);
   const simd::int32v_t one(1);
 
@@ -43,11 +171,32 @@ void intersect(
   while (top > 0) {
     auto& cur = tasks[--top];
 
-    if (!cur.is_leaf()) {
-      const auto& node = bvh->root[cur.offset];
+    if (!cur.is_leaf() && cur.num_rays < threshold) {
+      // streams this small aren't worth the book keeping anymore
+      auto todo = pop(lanes, cur.lane, cur.num_rays);
+      auto end  = todo + cur.num_rays;
+
+      for (; todo != end; ++todo) {
+        const auto ray = *todo;
+
+        if ((Occlusion || stream->is_shadow(ray)) && stream->is_hit(ray)) {
+          continue;
+        }
+
+        ++state->stats.single_rays;
+
+        visited += intersect_single<Occlusion>(
+          state->stack, stream, ray, bvh, nodes, cur.offset);
+      }
+    }
+    else if (!cur.is_leaf()) {
+      const auto& node = nodes[cur.offset];
       auto todo = pop(lanes, cur.lane, cur.num_rays);
 
-      __aligned(64) const simd::aabb_t<accel::mbvh_t::width> bounds(node.bounds);
+      ++state->stats.stream_tasks;
+
+      // compressed bounds get decoded once, and reused for all rays
+      __aligned(64) const simd::aabb_t<accel::mbvh_t::width> bounds(decode(node));
 
       simd::int32v_t num_active(0);
 
@@ -58,11 +207,13 @@ void intersect(
 
         const auto ray = *todo;
 
-        if (stream->is_shadow(ray) && stream->is_hit(ray)) {
+        if ((Occlusion || stream->is_shadow(ray)) && stream->is_hit(ray)) {
           ++todo;
           continue;
         }
 
+        ++visited;
+
         auto hits =
         simd::intersect<accel::mbvh_t::width>(
           bounds
@@ -85,11 +236,26 @@ void intersect(
         ++todo;
       }
 
-      uint32_t ids[8];
+      for (auto i=0; i<accel::mbvh_t::width; ++i) {
+        state->stats.lane_peak = std::max(state->stats.lane_peak, lanes.num[i]);
+      }
 
       __aligned(32) int32_t num_rays[8];
       num_active.store(num_rays);
 
+      // any hit is good enough for occlusion queries, so the order
+      // children are visited in doesn't matter
+      if (Occlusion) {
+        for (auto i=0; i<8; ++i) {
+          if (num_rays[i] > 0) {
+            push(tasks, top, node, i, num_rays[i]);
+          }
+        }
+        continue;
+      }
+
+      uint32_t ids[8];
+
       __aligned(32) float dists[8];
       length.store(dists);
 
@@ -127,12 +293,25 @@ void intersect(
         auto prims = 0;
         const auto num = std::min(end - begin, (long) accel::mbvh_t::width);
 
+        ++state->stats.leaf_packets;
+        state->stats.leaf_rays += num;
+
         do {
-          if (num < 8) {
-            bvh->triangles[index].iterate_rays(stream, begin, num);
+          const auto& triangles = bvh->triangles[index];
+
+          if (Occlusion) {
+            if (num < 8) {
+              triangles.occluded_rays(stream, begin, num);
+            }
+            else {
+              triangles.occluded_triangles(stream, begin, num);
+            }
+          }
+          else if (num < 8) {
+            triangles.iterate_rays(stream, begin, num);
     	    }
     	    else {
-    	      bvh->triangles[index].iterate_triangles(stream, begin, num);
+    	      triangles.iterate_triangles(stream, begin, num);
     	    }
           
           // DEBUG: bvh->triangles[index].baseline(stream, begin, num);
@@ -145,11 +324,14 @@ void intersect(
       }
     }
   }
+
+  state->stats.nodes += visited;
 }
 
-stream_mbvh_kernel_t::stream_mbvh_kernel_t(const accel::mbvh_t* bvh)
-: details(new details_t())
+stream_mbvh_kernel_t::stream_mbvh_kernel_t(const accel::mbvh_t* bvh, uint32_t threshold)
+: details(new details_t(bvh))
 , bvh(bvh)
+, threshold(threshold)
 {}
 
 stream_mbvh_kernel_t::~stream_mbvh_kernel_t() {
@@ -157,5 +339,23 @@ stream_mbvh_kernel_t::~stream_mbvh_kernel_t() {
 }
 
 void stream_mbvh_kernel_t::trace(ray_t<>* rays, active_t<>& active) const {
-  intersect(details, rays, active, bvh);
+  if (bvh->compressed) {
+    intersect<false>(details, rays, active, bvh, bvh->compressed, threshold);
+  }
+  else {
+    intersect<false>(details, rays, active, bvh, bvh->root, threshold);
+  }
+}
+
+void stream_mbvh_kernel_t::occluded(ray_t<>* rays, active_t<>& active) const {
+  if (bvh->compressed) {
+    intersect<true>(details, rays, active, bvh, bvh->compressed, threshold);
+  }
+  else {
+    intersect<true>(details, rays, active, bvh, bvh->root, threshold);
+  }
+}
+
+const stream_mbvh_kernel_t::stats_t& stream_mbvh_kernel_t::stats() const {
+  return details->stats;
 }
@@ -3,6 +3,8 @@
 #include "state.hpp"
 #include "utils/allocator.hpp"
 
+#include <algorithm>
+
 namespace accel {
   struct mbvh_t;
 }
@@ -11,16 +13,69 @@ struct stream_mbvh_kernel_t {
   struct details_t;
   details_t* details;
 
+  /* traversal statistics, collected over the lifetime of a kernel */
+  struct stats_t {
+    // number of rays traced, and the number of streams they were
+    // traced in
+    uint64_t rays;
+    uint64_t streams;
+    // number of nodes visited, summed over all rays
+    uint64_t nodes;
+    // number of node visits done with a whole stream of rays
+    uint64_t stream_tasks;
+    // number of times a ray left the stream, and continued with
+    // single ray traversal
+    uint64_t single_rays;
+    // number of ray packets tested against leaves in stream traversal,
+    // and the number of rays in them. this shows how well the simd
+    // lanes in the triangle tests are used
+    uint64_t leaf_packets;
+    uint64_t leaf_rays;
+    // bytes of ray ids reserved for the lanes of stream traversal, and
+    // the most rays any lane held at once. these are the largest values
+    // over all kernels, not sums
+    uint64_t lane_bytes;
+    uint32_t lane_peak;
+
+    inline stats_t()
+      : rays(0), streams(0), nodes(0), stream_tasks(0), single_rays(0)
+      , leaf_packets(0), leaf_rays(0), lane_bytes(0), lane_peak(0)
+    {}
+
+    inline void add(const stats_t& other) {
+      rays         += other.rays;
+      streams      += other.streams;
+      nodes        += other.nodes;
+      stream_tasks += other.stream_tasks;
+      single_rays  += other.single_rays;
+      leaf_packets += other.leaf_packets;
+      leaf_rays    += other.leaf_rays;
+      lane_bytes    = std::max(lane_bytes, other.lane_bytes);
+      lane_peak     = std::max(lane_peak, other.lane_peak);
+    }
+  };
+
   const accel::mbvh_t* bvh;
 
-  stream_mbvh_kernel_t(const accel::mbvh_t* bvh);
+  // streams with fewer rays than this get split up, and traced one ray
+  // at a time. 0 disables single ray traversal
+  uint32_t threshold;
+
+  stream_mbvh_kernel_t(const accel::mbvh_t* bvh, uint32_t threshold = 0);
   ~stream_mbvh_kernel_t();
 
   /* find the closest intersection point for all rays in the
    * current work item in the pipeline */
   void trace(ray_t<>* rays, active_t<>& active) const;
 
+  /* check if rays hit anything at all, before they reach their
+   * maximum distance. this only sets the hit flag, and distance of
+   * occluded rays */
+  void occluded(ray_t<>* rays, active_t<>& active) const;
+
   inline void operator()(ray_t<>* rays, active_t<>& active) const {
     trace(rays, active);
   }
+
+  const stats_t& stats() const;
 };
@@ -2,113 +2,384 @@
 #include "material.hpp"
 #include "mesh.hpp"
 #include "scene.hpp"
+#include "math/distribution.hpp"
 #include "math/sampling.hpp"
+#include "utils/color.hpp"
 
 #include <algorithm>
-#include <random> 
+#include <cmath>
 
 struct area_light_t : public light_t::details_t {
+  // maximum number of points emission is evaluated at, to estimate
+  // the power of a light
+  static const uint32_t MAX_POWER_SAMPLES = 64;
+  // resolution of the map emission gets baked into, for materials
+  // whose emission only depends on uv coordinates
+  static const uint32_t EMISSION_MAP_SIZE = 256;
+
   mesh_t* mesh;
   uint32_t set;
   std::vector<triangle_t> triangles;
   float area;
-  float* cdf;
+  // picks triangles with a probability proportional to their area
+  sample::alias_table_t distribution;
+
+  // precomputed emission, so light samples don't need to run the
+  // shader of the light's material
+  material_t::emission_t emission;
+  Imath::Color3f constant_emission;
+  std::vector<Imath::Color3f> emission_map;
 
   area_light_t(mesh_t* mesh, uint32_t set)
     : mesh(mesh)
     , set(set)
     , details_t(mesh->material(set))
     , area(0.0f)
+    , emission(material_t::EMISSION_VARYING)
+    , constant_emission(0.0f)
   {
     mesh->triangles(set, triangles);
   }
 
-  ~area_light_t() {
-    delete cdf;
-  }
-
   void preprocess(const scene_t* scene) {
-    // compute cdf based on the area of each triangle of
-    // the face set that defines the surface of this light source
-    cdf = new float[triangles.size()];
-
     const auto num = triangles.size();
 
+    std::vector<float> areas(num);
+
+    area = 0.0f;
     for (auto i=0; i<num; ++i) {
-      area += triangles[i].area();
-      cdf[i] = area;
+      areas[i] = triangles[i].area();
+      area += areas[i];
     }
 
-    for (auto i=0; i<num; ++i) {
-      cdf[i] /= area;
+    distribution.build(areas.data(), num);
+
+    bound_surface();
+    bake_emission(scene);
+
+    // the power estimate uses the baked emission, where there is one
+    power = estimate_power(scene);
+  }
+
+  void bake_emission(const scene_t* scene) {
+    auto material = scene->material(matid);
+
+    emission = material->emission();
+    emission_map.clear();
+
+    const Imath::V3f n(0.0f, 0.0f, 1.0f);
+
+    switch (emission) {
+    case material_t::EMISSION_CONSTANT:
+      {
+        shading_result_t result;
+        material->evaluate(Imath::V3f(0.0f), -n, n, {0.5f, 0.5f}, result);
+        constant_emission = result.e;
+        break;
+      }
+    case material_t::EMISSION_UV:
+      emission_map.resize(EMISSION_MAP_SIZE * EMISSION_MAP_SIZE);
+
+      for (auto y=0u; y<EMISSION_MAP_SIZE; ++y) {
+        for (auto x=0u; x<EMISSION_MAP_SIZE; ++x) {
+          const Imath::V2f st(
+            (x + 0.5f) / EMISSION_MAP_SIZE
+          , (y + 0.5f) / EMISSION_MAP_SIZE);
+
+          shading_result_t result;
+          material->evaluate(Imath::V3f(0.0f), -n, n, st, result);
+          emission_map[y * EMISSION_MAP_SIZE + x] = result.e;
+        }
+      }
+      break;
+    default:
+      break;
     }
   }
 
-  void sample(const Imath::V2f& uv, sampler_t::light_sample_t& out) const {
+  /* bilinear lookup into the emission map. uv coordinates wrap
+   * around, like repeating textures */
+  Imath::Color3f lookup_emission(const Imath::V2f& st) const {
+    const auto x = (st.x - std::floor(st.x)) * EMISSION_MAP_SIZE - 0.5f;
+    const auto y = (st.y - std::floor(st.y)) * EMISSION_MAP_SIZE - 0.5f;
+
+    const auto fx = std::floor(x);
+    const auto fy = std::floor(y);
+    const auto tx = x - fx;
+    const auto ty = y - fy;
+
+    const auto wrap = [](int i) {
+      return (uint32_t) ((i + (int) EMISSION_MAP_SIZE) % (int) EMISSION_MAP_SIZE);
+    };
+
+    const auto x0 = wrap((int) fx), x1 = wrap((int) fx + 1);
+    const auto y0 = wrap((int) fy), y1 = wrap((int) fy + 1);
+
+    const auto& m = emission_map;
+    const auto  w = EMISSION_MAP_SIZE;
+
+    return
+      (m[y0*w + x0] * (1.0f - tx) + m[y0*w + x1] * tx) * (1.0f - ty) +
+      (m[y1*w + x0] * (1.0f - tx) + m[y1*w + x1] * tx) * ty;
+  }
+
+  bool emitted(const Imath::V2f& st, Imath::Color3f& e) const {
+    switch (emission) {
+    case material_t::EMISSION_CONSTANT:
+      e = constant_emission;
+      return true;
+    case material_t::EMISSION_UV:
+      e = lookup_emission(st);
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /* compute bounds of the triangles, and a cone containing their
+   * normals. lights emit on both sides, so normals are flipped to
+   * point into the same half space first */
+  void bound_surface() {
+    bounds.makeEmpty();
+
+    if (triangles.empty()) {
+      return;
+    }
+
+    std::vector<Imath::V3f> normals;
+    normals.reserve(triangles.size());
+
+    Imath::V3f sum(0.0f);
+    for (const auto& triangle : triangles) {
+      bounds.extendBy(triangle.a());
+      bounds.extendBy(triangle.b());
+      bounds.extendBy(triangle.c());
+
+      // the length of the cross product is twice the area
+      auto n = (triangle.b() - triangle.a()).cross(triangle.c() - triangle.a());
+      if (!normals.empty() && n.dot(normals.front()) < 0.0f) {
+        n = -n;
+      }
+
+      sum += n;
+      normals.push_back(n.normalized());
+    }
+
+    if (sum.length() < 1e-12f) {
+      axis = normals.front();
+      cos_theta = 0.0f;
+      return;
+    }
+
+    axis = sum.normalized();
+    cos_theta = 1.0f;
+    for (const auto& n : normals) {
+      cos_theta = std::min(cos_theta, std::fabs(axis.dot(n)));
+    }
+  }
+
+  /* emitted radiance times area. baked emission is averaged over the
+   * emission map. otherwise emission is evaluated at the centers of a
+   * subset of the triangles, looking at the front face, the same way
+   * light samples get shaded */
+  float estimate_power(const scene_t* scene) const {
     const auto num = triangles.size();
 
-    // auto i = 0;
-    // while (i < (num-1) && uv.x > cdf[i]) {
-    //   ++i;
-    // }
+    if (num == 0) {
+      return 0.0f;
+    }
 
-    const auto i = std::min((size_t)std::floor(uv.x * num), num - 1);
+    switch (emission) {
+    case material_t::EMISSION_CONSTANT:
+      return color::y(constant_emission) * area;
+    case material_t::EMISSION_UV:
+      {
+        auto radiance = 0.0f;
+        for (const auto& e : emission_map) {
+          radiance += color::y(e);
+        }
+        return emission_map.empty() ? 0.0f : (radiance / emission_map.size()) * area;
+      }
+    default:
+      break;
+    }
 
-    const auto one_minus_epsilon =
-      1.0f-std::numeric_limits<float>::epsilon();
-    const auto remapped =
-      std::min(uv.x * num - i, one_minus_epsilon);
+    auto material = scene->material(matid);
+
+    const auto step = std::max((size_t) 1, num / MAX_POWER_SAMPLES);
+
+    auto radiance = 0.0f;
+    auto weight   = 0.0f;
+    for (auto i=0; i<num; i+=step) {
+      const auto& triangle = triangles[i];
+
+      const Imath::V2f center(1.0f/3.0f, 1.0f/3.0f);
+
+      const auto p = triangle.barycentric_to_point(center);
+      const auto n = (triangle.b() - triangle.a()).cross(triangle.c() - triangle.a()).normalized();
+
+      shading_result_t result;
+      material->evaluate(p, -n, n, triangle.barycentric_to_st(center), result);
+
+      radiance += color::y(result.e) * triangle.area();
+      weight   += triangle.area();
+    }
+
+    return weight > 0.0f ? (radiance / weight) * area : 0.0f;
+  }
+
+  float pdf(const Imath::V3f& from, const Imath::V3f& p, const Imath::V3f& n) const {
+    auto wi = p - from;
+    const auto d2 = wi.length2();
+
+    if (area <= 0.0f || d2 <= 0.0f) {
+      return 0.0f;
+    }
+
+    wi *= 1.0f / std::sqrt(d2);
+
+    const auto cos_theta = std::fabs(n.dot(wi));
+    return cos_theta > 0.0f ? d2 / (area * cos_theta) : 0.0f;
+  }
+
+  void sample(const Imath::V2f& uv, sampler_t::light_sample_t& out) const {
+    float pdf, remapped;
+    const auto i = distribution.sample(uv.x, pdf, remapped);
 
     const auto& triangle    = triangles[i];
     const auto  barycentric = triangle_t::sample({remapped, uv.y});
 
     out.p    = triangle.barycentric_to_point(barycentric);
     out.uv   = barycentric;
+    // triangles are picked proportional to their area, so points
+    // are distributed uniformly over the whole light
     out.pdf  = 1.0f / area;
     out.mesh = triangle.meshid() | (triangle.matid() << 16);
     out.face = triangle.face;
     out.area = area;
   }
+};
 
-  void sample(
-    const soa::vector2_t<sampler_t::light_samples_t::step>& uv
-  , sampler_t::light_samples_t& out) const
-  {
-  //   const auto one = simd::floatv_t(1.0f);
-  //   const auto num = simd::floatv_t(triangles.size());
+/* an infinite light is defined by a background shader. the shader is
+ * baked into a latitude-longitude map of the radiance around the scene
+ * when preprocessing, so shadow rays towards the environment don't need
+ * to run the shader, and directions can be sampled proportional to the
+ * radiance coming from them. the y axis points to the poles of the map */
+struct infinite_light_t : public light_t::details_t {
+  static const uint32_t MAP_WIDTH  = 512;
+  static const uint32_t MAP_HEIGHT = 256;
 
-  //   auto x = simd::floatv_t(uv.x);
-  //   auto y = simd::floatv_t(uv.y);
+  std::vector<Imath::Color3f> radiance;
+  // picks texels of the map proportional to the radiance they
+  // contribute to the sphere of directions
+  sample::distribution_2d_t distribution;
 
-  //   const auto indices = simd::min(simd::floor(x * num), num - one);
+  infinite_light_t(uint32_t matid)
+    : details_t(matid)
+  {}
 
-  //   const auto e = std::numeric_limits<float>::epsilon();
-  //   const auto one_minus_epsilon = simd::floatv_t(1.0f-e);
+  static inline Imath::V3f to_direction(float x, float y) {
+    const auto theta = y * (float) M_PI;
+    const auto phi   = x * (float) (2.0 * M_PI);
+    const auto r     = std::sin(theta);
 
-  //   x = simd::min(x * num, one_minus_epsilon);
+    return { r * std::cos(phi), std::cos(theta), r * std::sin(phi) };
+  }
 
-  //   const auto barycentrics = triangle_t::sample(x, y);
+  static inline void to_map(const Imath::V3f& dir, float& x, float& y) {
+    auto phi = std::atan2(dir.z, dir.x);
+    if (phi < 0.0f) {
+      phi += (float) (2.0 * M_PI);
+    }
 
-  //   out.p = mesh->barycentrics_to_point(set, indices, barycentrics);
-  //   out.u = barycentrics.x;
-  //   out.v = barycentrics.y;
-  //   out.pdf = simd::floatv_t(1.0f / area);
-  //   // out.mesh = simd::int32v_t(mesh->id | (matid << 16));
-  //   // out.face = mesh->face_ids(set, indices);
-  }  
-};
+    x = phi * (float) (0.5 / M_PI);
+    y = std::acos(std::max(-1.0f, std::min(dir.y, 1.0f))) * (float) M_1_PI;
+  }
 
-struct infinite_light_t : public light_t::details_t {
-  infinite_light_t(uint32_t matid)
-    : details_t(matid)
-  {}
+  void preprocess(const scene_t* scene) {
+    auto material = scene->material(matid);
+
+    radiance.resize(MAP_WIDTH * MAP_HEIGHT);
+    std::vector<float> weights(MAP_WIDTH * MAP_HEIGHT);
+
+    auto total = 0.0f;
+    for (auto y=0; y<MAP_HEIGHT; ++y) {
+      const auto v = (y + 0.5f) / MAP_HEIGHT;
+      // texels get smaller towards the poles
+      const auto sin_theta = std::sin(v * (float) M_PI);
+
+      for (auto x=0; x<MAP_WIDTH; ++x) {
+        const auto u   = (x + 0.5f) / MAP_WIDTH;
+        const auto dir = to_direction(u, v);
+
+        // the same setup as the shading of rays leaving the scene
+        shading_result_t result;
+        material->evaluate(Imath::V3f(0.0f), dir, -dir, {u, v}, result);
+
+        const auto i = y * MAP_WIDTH + x;
+        radiance[i] = result.e;
+        weights[i]  = color::y(result.e) * sin_theta;
+
+        total += weights[i];
+      }
+    }
+
+    distribution.build(weights.data(), MAP_WIDTH, MAP_HEIGHT);
+
+    bounds = scene->bounds();
+
+    // the radiance integrated over all directions, relative to the
+    // area of a sphere around the scene. this is on the same scale as
+    // the power of area lights
+    const auto radius = bounds.isEmpty() ? 1.0f : bounds.size().length() * 0.5f;
+    const auto texel  = (float) (2.0 * M_PI * M_PI) / (MAP_WIDTH * MAP_HEIGHT);
+
+    power = total * texel * radius * radius;
+  }
+
+  inline uint32_t texel(const Imath::V3f& dir) const {
+    float u, v;
+    to_map(dir, u, v);
+
+    const auto x = std::min((uint32_t) (u * MAP_WIDTH), MAP_WIDTH - 1);
+    const auto y = std::min((uint32_t) (v * MAP_HEIGHT), MAP_HEIGHT - 1);
+
+    return y * MAP_WIDTH + x;
+  }
+
+  Imath::Color3f eval(const Imath::V3f& dir) const {
+    return radiance.empty() ? Imath::Color3f(0.0f) : radiance[texel(dir)];
+  }
+
+  /* converts the pdf of the map to solid angle */
+  float pdf(const Imath::V3f& dir) const {
+    if (radiance.empty()) {
+      return 0.0f;
+    }
+
+    float u, v;
+    to_map(dir, u, v);
+
+    const auto sin_theta = std::sin(v * (float) M_PI);
+    if (sin_theta <= 0.0f) {
+      return 0.0f;
+    }
+
+    return distribution.pdf(u, v) / ((float) (2.0 * M_PI * M_PI) * sin_theta);
+  }
 
   void sample(const Imath::V2f& uv, sampler_t::light_sample_t& out) const  {
-    Imath::V3f sampled;
-    sample::hemisphere::uniform(uv, sampled, out.pdf);
+    float u, v, pdf;
+    distribution.sample(uv.x, uv.y, u, v, pdf);
 
-    out.p = sampled * 1000.0f;
-    out.mesh = matid << 16;
+    const auto sin_theta = std::sin(v * (float) M_PI);
+
+    out.p    = to_direction(u, v);
+    out.uv   = Imath::V2f(u, v);
+    out.pdf  = sin_theta > 0.0f ? pdf / ((float) (2.0 * M_PI * M_PI) * sin_theta) : 0.0f;
+    out.mesh = ENVIRONMENT | (matid << 16);
+    out.face = 0;
+    out.area = 0.0f;
   }
 };
 
@@ -125,6 +396,9 @@ void light_t::preprocess(const scene_t* scene) {
   case AREA:
     static_cast<area_light_t*>(details)->preprocess(scene);
     break;
+  case INFINITE:
+    static_cast<infinite_light_t*>(details)->preprocess(scene);
+    break;
   default:
     // nothing to do for other light sources
     break;
@@ -149,19 +423,68 @@ void light_t::sample(
 
 void light_t::sample(
   const soa::vector2_t<sampler_t::light_samples_t::step>& uv
-, sampler_t::light_samples_t& out) const
+, sampler_t::light_samples_t::packet_t& out) const
 {
-  switch(type) {
-  case POINT:
-    break;
-  case AREA:
-    static_cast<const area_light_t*>(details)->sample(uv, out);
-    break;
-  case INFINITE:
-    // static_cast<const infinite_light_t*>(details)->sample(uv, out);
-    printf("SIMD sampling not implemented on infinite lights");
-    break;
+  // picking triangles, and texels are table lookups, which don't
+  // vectorize well, so lanes get sampled one at a time
+  for (auto i=0; i<sampler_t::light_samples_t::step; ++i) {
+    sampler_t::light_sample_t sample;
+    sample.pdf = 0.0f;
+    sample.mesh = 0;
+    sample.face = 0;
+
+    this->sample(uv.at(i), sample);
+
+    out.p.from(i, sample.p);
+    out.u[i] = sample.uv.x;
+    out.v[i] = sample.uv.y;
+    out.pdf[i] = sample.pdf;
+    out.mesh[i] = sample.mesh;
+    out.face[i] = sample.face;
+  }
+}
+
+Imath::Color3f light_t::eval(const Imath::V3f& dir) const {
+  if (type == INFINITE) {
+    return static_cast<const infinite_light_t*>(details)->eval(dir);
   }
+  return Imath::Color3f(0.0f);
+}
+
+float light_t::pdf(const Imath::V3f& dir) const {
+  if (type == INFINITE) {
+    return static_cast<const infinite_light_t*>(details)->pdf(dir);
+  }
+  return 0.0f;
+}
+
+float light_t::pdf(const Imath::V3f& from, const Imath::V3f& p, const Imath::V3f& n) const {
+  if (type == AREA) {
+    return static_cast<const area_light_t*>(details)->pdf(from, p, n);
+  }
+  return 0.0f;
+}
+
+bool light_t::emission(const Imath::V2f& st, Imath::Color3f& e) const {
+  if (type == AREA) {
+    return static_cast<const area_light_t*>(details)->emitted(st, e);
+  }
+  return false;
+}
+
+bool light_t::faces(uint32_t& mesh, std::vector<uint32_t>& out) const {
+  if (type != AREA) {
+    return false;
+  }
+
+  const auto area = static_cast<const area_light_t*>(details);
+
+  mesh = area->mesh->id;
+  for (const auto& triangle : area->triangles) {
+    out.push_back(triangle.face);
+  }
+
+  return true;
 }
 
 light_t* light_t::make_area(mesh_t* mesh, uint32_t set) {
@@ -2,6 +2,11 @@
 
 #include "sampling.hpp"
 
+#include <ImathBox.h>
+#include <ImathColor.h>
+
+#include <vector>
+
 struct material_t;
 struct mesh_t;
 struct scene_t;
@@ -15,9 +20,21 @@ struct light_t {
 
   struct details_t {
     uint32_t matid;
+    // estimate of the emitted power, used to pick lights for
+    // light sampling. computed when preprocessing the light
+    float power;
+    // bounds of the light's surface
+    Imath::Box3f bounds;
+    // all surface normals of the light, or their opposites, are
+    // within an angle with this cosine around this axis
+    Imath::V3f axis;
+    float cos_theta;
 
     details_t(uint32_t matid)
       : matid(matid)
+      , power(0.0f)
+      , axis(0.0f, 0.0f, 1.0f)
+      , cos_theta(0.0f)
     {}
   } *details;
 
@@ -38,7 +55,29 @@ struct light_t {
    * the cpu */
   void sample(
     const soa::vector2_t<sampler_t::light_samples_t::step>& uv
-  , sampler_t::light_samples_t& out) const;
+  , sampler_t::light_samples_t::packet_t& out) const;
+
+  /* radiance an infinite light emits towards the scene, from a
+   * direction */
+  Imath::Color3f eval(const Imath::V3f& dir) const;
+
+  /* the solid angle probability of sampling a direction on an
+   * infinite light */
+  float pdf(const Imath::V3f& dir) const;
+
+  /* the solid angle probability of sampling a point 'p' with normal
+   * 'n' on an area light, as seen from 'from' */
+  float pdf(const Imath::V3f& from, const Imath::V3f& p, const Imath::V3f& n) const;
+
+  /* precomputed radiance emitted by an area light, at a point with
+   * surface parameters 'st'. returns false, if the emission depends
+   * on more than that, and the light's material has to be evaluated */
+  bool emission(const Imath::V2f& st, Imath::Color3f& e) const;
+
+  /* the faces an area light emits from, given as mesh id, and the
+   * offsets of the faces into the mesh's indices, like rays store the
+   * faces they hit. returns false for other lights */
+  bool faces(uint32_t& mesh, std::vector<uint32_t>& out) const;
 
   inline bool is_area() const {
     return type == AREA;
@@ -48,6 +87,32 @@ struct light_t {
     return type == INFINITE;
   }
   
+  /* the emitted power of the light source */
+  inline float power() const {
+    return details->power;
+  }
+
+  /* the space the light occupies */
+  inline const Imath::Box3f& bounds() const {
+    return details->bounds;
+  }
+
+  /* the light emits in directions around this axis, and its opposite */
+  inline const Imath::V3f& axis() const {
+    return details->axis;
+  }
+
+  /* cosine of the angle around the axis, all surface normals are in */
+  inline float cos_theta() const {
+    return details->cos_theta;
+  }
+
+  /* infinite lights sample directions. this turns a sampled direction
+   * into a point outside of the scene, as seen from a point in it */
+  inline Imath::V3f outside(const Imath::V3f& p, const Imath::V3f& dir) const {
+    return p + dir * (2.0f * bounds().size().length() + 1.0f);
+  }
+
   /* get the material for this light source */
   inline uint32_t matid() const {
     return details->matid;
@@ -18,6 +18,9 @@
 
 #include <OpenImageIO/sysutil.h>
 
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
 #include <set>
 
 using namespace OSL_NAMESPACE;
@@ -110,10 +113,36 @@ struct material_t::details_t {
 
   std::set<std::string> attributes;
 
+  /* closure output of a group, that doesn't depend on the shading
+   * point. lobes can still use the shading normal, which gets filled
+   * in per hit point */
+  struct constant_t {
+    bsdf_t bsdf;
+    Imath::Color3f e;
+    // bit mask of the lobes, that use the shading normal
+    uint32_t normal_lobes;
+  };
+
+  // set for groups, that got baked into a constant closure
+  constant_t* constant;
+
+  emission_t emission;
+
+  // number of lobes bsdfs of this material get storage for. this
+  // is the number of different scattering closures the group uses
+  uint32_t max_lobes;
+
   details_t()
     : is_emitter(false)
+    , constant(nullptr)
+    , emission(EMISSION_VARYING)
+    , max_lobes(bsdf_t::MaxLobes)
   {}
 
+  ~details_t() {
+    delete constant;
+  }
+
   static void boot(const std::string& path) {
     using namespace bsdf;
 
@@ -181,6 +210,11 @@ struct material_t::details_t {
   }
 
   static void attach() {
+    if (pti) {
+      // thread was already attached
+      return;
+    }
+
     pti = system->create_thread_info();
     ctx = system->get_context(pti);
   }
@@ -202,11 +236,144 @@ struct material_t::details_t {
     ustring* closures;
     system->getattribute(group.get(), "closures_needed", TypeDesc::PTR, &closures);
 
+    max_lobes = 0;
+
     for (auto i=0; i<num_closures; ++i) {
       if (closures[i] == "emission") {
         is_emitter = true;
       }
+      else if (closures[i] != "background") {
+        ++max_lobes;
+      }
+    }
+
+    max_lobes = std::min(max_lobes, bsdf_t::MaxLobes);
+
+    bake();
+
+    if (constant) {
+      emission = EMISSION_CONSTANT;
+    }
+    else if (reads_only({ "u", "v" })) {
+      emission = EMISSION_UV;
+    }
+  }
+
+  /* checks if the optimized group reads nothing from the shading
+   * point, but the given globals */
+  bool reads_only(std::initializer_list<const char*> allowed) const {
+    int num_globals = 0;
+    system->getattribute(group.get(), "num_globals_needed", num_globals);
+
+    ustring* globals;
+    system->getattribute(group.get(), "globals_needed", TypeDesc::PTR, &globals);
+
+    for (auto i=0; i<num_globals; ++i) {
+      if (std::none_of(allowed.begin(), allowed.end(), [&](const char* name) {
+            return globals[i] == name; })) {
+        return false;
+      }
+    }
+
+    int num_attributes = 0, unknown_attributes = 0, num_userdata = 0;
+    system->getattribute(group.get(), "num_attributes_needed", num_attributes);
+    system->getattribute(group.get(), "unknown_attributes_needed", unknown_attributes);
+    system->getattribute(group.get(), "num_userdata", num_userdata);
+
+    return num_attributes == 0 && unknown_attributes == 0 && num_userdata == 0;
+  }
+
+  /* run the group with a given shading normal, into a cleared bsdf */
+  bool probe(const Imath::V3f& n, bsdf_t& bsdf, Imath::Color3f& e) {
+    ShaderGlobals sg;
+    memset(&sg, 0, sizeof(ShaderGlobals));
+    sg.N = sg.Ng = n;
+
+    execute(sg);
+
+    if (!sg.Ci) {
+      return false;
+    }
+
+    shading_result_t result;
+    result.bsdf = &bsdf;
+
+    memset(&bsdf, 0, sizeof(bsdf_t));
+    bsdf_t::make(&bsdf, bsdf_t::MaxLobes);
+
+    eval_closure(result, sg.Ci);
+
+    e = result.e;
+
+    return !bsdf.overflowed();
+  }
+
+  /* bake the closure of groups, that produce the same closure for
+   * every shading point. the group is run with two different normals,
+   * and the results have to agree on everything but the lobe normals.
+   * lobes need to either keep a fixed normal, or use the shading
+   * normal */
+  void bake() {
+    if (!reads_only({ "N" })) {
+      return;
+    }
+
+    attach();
+
+    const Imath::V3f na(0.0f, 0.0f, 1.0f);
+    const Imath::V3f nb(0.48f, 0.6f, 0.64f);
+
+    std::unique_ptr<constant_t> a(new constant_t());
+    std::unique_ptr<constant_t> b(new constant_t());
+
+    if (!probe(na, a->bsdf, a->e) || !probe(nb, b->bsdf, b->e)) {
+      return;
+    }
+
+    if (a->e != b->e || a->bsdf.lobes != b->bsdf.lobes) {
+      return;
+    }
+
+    a->normal_lobes = 0;
+
+    for (auto i=0u; i<a->bsdf.lobes; ++i) {
+      const auto& a_lobe = a->bsdf.lobe[i];
+      const auto& b_lobe = b->bsdf.lobe[i];
+
+      auto la = (const bsdf::lobe_t*) a_lobe.params;
+      auto lb = (const bsdf::lobe_t*) b_lobe.params;
+
+      if (la->n == na && lb->n == nb) {
+        a->normal_lobes |= 1 << i;
+      }
+      else if (la->n != lb->n) {
+        return;
+      }
+
+      const auto rest = sizeof(bsdf_t::param_t) - sizeof(bsdf::lobe_t);
+
+      if (a_lobe.type != b_lobe.type ||
+          a_lobe.flags != b_lobe.flags ||
+          a_lobe.weight != b_lobe.weight ||
+          memcmp(la + 1, lb + 1, rest) != 0) {
+        return;
+      }
     }
+
+    constant = a.release();
+  }
+
+  /* instantiate the baked closure for a shading point */
+  bsdf_t* instantiate(const Imath::V3f& n, void* mem) const {
+    auto bsdf = constant->bsdf.copy(mem);
+
+    for (auto i=0u; i<bsdf->lobes; ++i) {
+      if (constant->normal_lobes & (1 << i)) {
+        ((bsdf::lobe_t*) bsdf->lobe[i].params)->n = n;
+      }
+    }
+
+    return bsdf;
   }
 
   void execute(ShaderGlobals& sg) {
@@ -215,6 +382,69 @@ struct material_t::details_t {
     }
   }
 
+  /* run the shader group for a hit point, and store the resulting
+   * emission and bsdf with it. only the globals that differ between
+   * hit points get written to 'sg'. 'slot' is storage for a bsdf
+   * with 'max_lobes' lobes. returns false, if the group produced no
+   * closure */
+  bool shade(
+    allocator_t& allocator
+  , interaction_t<>* hits
+  , uint32_t index
+  , ShaderGlobals& sg
+  , void* slot)
+  {
+    if (constant) {
+      const auto lobes = constant->bsdf.lobes;
+      const auto mem   = lobes <= max_lobes ? slot : allocator.allocate(bsdf_t::size(lobes));
+
+      hits->e.from(index, constant->e);
+      hits->bsdf[index] = instantiate(hits->n.at(index), mem);
+
+      return true;
+    }
+
+    sg.P = hits->p.at(index);
+    sg.I = hits->wi.at(index);
+    sg.N = sg.Ng = hits->n.at(index);
+    sg.u = hits->s[index];
+    sg.v = hits->t[index];
+    sg.backfacing = sg.N.dot(sg.I) < 0;
+
+    execute(sg);
+
+    if (sg.Ci) {
+      shading_result_t result;
+      result.bsdf = bsdf_t::make(slot, max_lobes);
+
+      eval_closure(result, sg.Ci);
+
+      if (result.bsdf->overflowed()) {
+        // closures can be used more than once in a group, so a bsdf
+        // can have more lobes than the group has different closures
+        bsdf_t all;
+
+        result.e    = Imath::V3f(0.0f);
+        result.bsdf = &all;
+
+        eval_closure(result, sg.Ci);
+
+        all.lobes   = std::min(all.lobes, all.capacity);
+        result.bsdf = all.copy(allocator.allocate(bsdf_t::size(all.lobes)));
+      }
+
+      hits->e.from(index, result.e);
+      hits->bsdf[index] = result.bsdf;
+
+      return true;
+    }
+
+    hits->e.from(index, Imath::Color3f(0.0f));
+    hits->bsdf[index] = nullptr;
+
+    return false;
+  }
+
   void eval_closure(
     shading_result_t& result
   , const ClosureColor* c
@@ -421,35 +651,26 @@ void material_t::evaluate(
 , interaction_t<>* hits
 , const active_t<>& active)
 {
-  for (auto i=0; i<active.num; ++i) {
-    const auto index = active.index[i];
-
-    service_t::object_t obj{hits, index};
-
-    ShaderGlobals sg;
-    memset(&sg, 0, sizeof(ShaderGlobals));
-    sg.P = hits->p.at(index);
-    sg.I = hits->wi.at(index);
-    sg.N = sg.Ng = hits->n.at(index);
-    sg.u = hits->s[index];
-    sg.v = hits->t[index];
-    sg.backfacing = sg.N.dot(sg.I) < 0;
-    sg.objdata = &obj;
+  if (active.num == 0) {
+    return;
+  }
 
-    details->execute(sg);
+  service_t::object_t obj{hits, 0};
 
-    if (sg.Ci) {
-      shading_result_t result; 
-      result.bsdf = new(allocator) bsdf_t();
+  // the shading system resets its outputs on every execution, so the
+  // same globals can be reused for all points in the batch
+  ShaderGlobals sg;
+  memset(&sg, 0, sizeof(ShaderGlobals));
+  sg.objdata = &obj;
 
-      details->eval_closure(result, sg.Ci);
+  // bsdfs only get storage for the lobes the material can produce
+  const auto stride = bsdf_t::size(details->max_lobes);
+  const auto bsdfs  = allocator.allocate(active.num * stride);
 
-      hits->e.from(index, result.e);
-      hits->bsdf[index] = result.bsdf;
-    } else {
-      hits->e.from(index, Imath::Color3f(0.0f));
-      hits->bsdf[index] = nullptr;
+  for (auto i=0; i<active.num; ++i) {
+    obj.i = active.index[i];
 
+    if (!details->shade(allocator, hits, obj.i, sg, bsdfs + i * stride)) {
       std::stringstream ss;
       ss << "CAN'T EVALUATE MATERIAL: " << id << ", " << is_emitter() << std::endl;
       std::cout << ss.str() << std::endl;
@@ -457,6 +678,26 @@ void material_t::evaluate(
   }
 }
 
+void material_t::evaluate(
+  allocator_t& allocator
+, interaction_t<>* hits
+, uint32_t index)
+{
+  service_t::object_t obj{hits, index};
+
+  ShaderGlobals sg;
+  memset(&sg, 0, sizeof(ShaderGlobals));
+  sg.objdata = &obj;
+
+  const auto bsdf = allocator.allocate(bsdf_t::size(details->max_lobes));
+
+  if (!details->shade(allocator, hits, index, sg, bsdf)) {
+    std::stringstream ss;
+    ss << "CAN'T EVALUATE MATERIAL: " << id << ", " << is_emitter() << std::endl;
+    std::cout << ss.str() << std::endl;
+  }
+}
+
 void material_t::evaluate(
   const Imath::V3f& p
 , const Imath::V3f& wi
@@ -464,6 +705,12 @@ void material_t::evaluate(
 , const Imath::V2f& st
 , shading_result_t& result)
 {
+  if (details->constant) {
+    result.e = details->constant->e;
+    result.bsdf = nullptr;
+    return;
+  }
+
   ShaderGlobals sg;
   memset(&sg, 0, sizeof(ShaderGlobals));
   sg.backfacing = n.dot(wi) < 0;
@@ -488,6 +735,10 @@ bool material_t::is_emitter() const {
   return details->is_emitter;
 }
 
+material_t::emission_t material_t::emission() const {
+  return details->emission;
+}
+
 bool material_t::has_attribute(const std::string& name) const {
   return details->attributes.count(name);
 }
@@ -50,6 +50,16 @@ struct material_t {
     virtual void add_attribute(const std::string& name) = 0;
   };
 
+  /* describes what the emission of a material depends on */
+  enum emission_t {
+    // the same at every point, and in every direction
+    EMISSION_CONSTANT,
+    // only depends on the surface parameterization of a point
+    EMISSION_UV,
+    // depends on the position, orientation, or the view
+    EMISSION_VARYING
+  };
+
   uint32_t id;
 
   material_t();
@@ -57,11 +67,20 @@ struct material_t {
 
   builder_t* builder();
 
+  /* shades all hit points in 'active' in one batch. shading globals
+   * are set up once for the batch, and bsdfs get allocated in one
+   * block */
   void evaluate(
     allocator_t& allocator
   , interaction_t<>* hits
   , const active_t<>& active);
 
+  /* shades a single hit point */
+  void evaluate(
+    allocator_t& allocator
+  , interaction_t<>* hits
+  , uint32_t index);
+
   void evaluate(
     const Imath::V3f& p
   , const Imath::V3f& wi
@@ -73,6 +92,10 @@ struct material_t {
    * meshes this material is attached to, will be considered for light sampling */
   bool is_emitter() const;
 
+  /* what the emission of this material depends on. lights use this
+   * to decide if emission can be precomputed */
+  emission_t emission() const;
+
   /**
    * Checks if this material has a special attribute attached to it
    * that signals requirements this material might have that require
@@ -80,7 +103,8 @@ struct material_t {
    */
   bool has_attribute(const std::string& name) const;
 
-  /* each thread needs to call this method to register itself with the material system */
+  /* each thread needs to call this method to register itself with the material system.
+   * attaching a thread more than once has no effect */
   static void attach();
 
   /* call this to intialize the static parts of the materia system. can be called with
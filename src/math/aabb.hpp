@@ -1,6 +1,9 @@
 #pragma once
 
 #include <ImathBox.h>
+#include <ImathVec.h>
+
+#include <algorithm>
 
 namespace aabb {
 
@@ -12,4 +15,67 @@ namespace aabb {
     auto d = box.max - box.min;
     return 2.0 * (d.x * d.y + d.x * d.z + d.y * d.z);
   }
+
+  /* the bounds of the part of a triangle that lies inside a box. the
+   * triangle gets clipped against all six planes of the box, which
+   * leaves a polygon with at most nine vertices */
+  inline Imath::Box3f clip(
+    const Imath::V3f& a
+  , const Imath::V3f& b
+  , const Imath::V3f& c
+  , const Imath::Box3f& box)
+  {
+    Imath::V3f buffers[2][9] = {{ a, b, c }};
+    auto num = 3;
+    auto cur = 0;
+
+    for (auto plane=0; plane<6 && num > 0; ++plane) {
+      const auto axis  = plane % 3;
+      const auto upper = plane >= 3;
+      const auto d     = upper ? box.max[axis] : box.min[axis];
+
+      const auto inside = [&](const Imath::V3f& v) {
+        return upper ? v[axis] <= d : v[axis] >= d;
+      };
+
+      const auto* in  = buffers[cur];
+      auto*       out = buffers[cur^1];
+      auto        n   = 0;
+
+      for (auto i=0; i<num; ++i) {
+        const auto& p = in[i];
+        const auto& q = in[(i+1) % num];
+
+        const auto p_inside = inside(p);
+        const auto q_inside = inside(q);
+
+        if (p_inside) {
+          out[n++] = p;
+        }
+
+        if (p_inside != q_inside) {
+          const auto t = (d - p[axis]) / (q[axis] - p[axis]);
+          out[n] = p + (q - p) * t;
+          out[n][axis] = d;
+          ++n;
+        }
+      }
+
+      num = n;
+      cur ^= 1;
+    }
+
+    Imath::Box3f out;
+    for (auto i=0; i<num; ++i) {
+      out.extendBy(buffers[cur][i]);
+    }
+
+    // keep numerical errors from growing the clipped bounds
+    for (auto axis=0; axis<3 && !out.isEmpty(); ++axis) {
+      out.min[axis] = std::max(out.min[axis], box.min[axis]);
+      out.max[axis] = std::min(out.max[axis], box.max[axis]);
+    }
+
+    return out;
+  }
 }
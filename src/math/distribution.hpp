@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <stdint.h>
+
+namespace sample {
+  /**
+   * A discrete distribution, that can be sampled in constant time.
+   * Every entry keeps itself with some probability, and points to
+   * another entry it gets replaced with otherwise
+   *
+   * See: Vose, "A Linear Algorithm for Generating Random Numbers with
+   * a Given Distribution", 1991
+   */
+  struct alias_table_t {
+    struct entry_t {
+      float    q;     // probability of keeping this entry
+      uint32_t alias; // the entry to pick otherwise
+      float    pdf;   // probability of sampling this entry
+    };
+
+    std::vector<entry_t> entries;
+
+    // sum of all weights
+    float total;
+
+    inline alias_table_t()
+      : total(0.0f)
+    {}
+
+    /* build the table from non negative weights. if all weights are
+     * zero, entries get sampled uniformly */
+    inline void build(const float* weights, uint32_t num) {
+      entries.resize(num);
+
+      total = 0.0f;
+      for (auto i=0u; i<num; ++i) {
+        total += weights[i];
+      }
+
+      if (num == 0) {
+        return;
+      }
+
+      std::vector<float>    scaled(num);
+      std::vector<uint32_t> small, large;
+
+      for (auto i=0u; i<num; ++i) {
+        const auto pdf = total > 0.0f ? weights[i] / total : 1.0f / num;
+
+        entries[i].pdf   = pdf;
+        entries[i].q     = 1.0f;
+        entries[i].alias = i;
+
+        scaled[i] = pdf * num;
+
+        if (scaled[i] < 1.0f) {
+          small.push_back(i);
+        }
+        else {
+          large.push_back(i);
+        }
+      }
+
+      while (!small.empty() && !large.empty()) {
+        const auto s = small.back(); small.pop_back();
+        const auto l = large.back(); large.pop_back();
+
+        entries[s].q     = scaled[s];
+        entries[s].alias = l;
+
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+
+        if (scaled[l] < 1.0f) {
+          small.push_back(l);
+        }
+        else {
+          large.push_back(l);
+        }
+      }
+
+      // whatever is left over is only off by rounding errors
+      for (auto i : small) {
+        entries[i].q = 1.0f;
+      }
+      for (auto i : large) {
+        entries[i].q = 1.0f;
+      }
+    }
+
+    inline uint32_t size() const {
+      return entries.size();
+    }
+
+    inline float pdf(uint32_t i) const {
+      return entries[i].pdf;
+    }
+
+    /* pick an entry with a uniform sample. the sample gets remapped to
+     * [0,1) afterwards, so it can be used again */
+    inline uint32_t sample(float u, float& pdf, float& remapped) const {
+      static const float one_minus_epsilon =
+        1.0f - std::numeric_limits<float>::epsilon();
+
+      const auto num = entries.size();
+      const auto x   = u * num;
+      const auto i   = std::min((uint32_t) x, (uint32_t) num - 1);
+      const auto r   = std::min(x - i, one_minus_epsilon);
+
+      const auto& entry = entries[i];
+
+      uint32_t out;
+      if (r < entry.q) {
+        out      = i;
+        remapped = r / entry.q;
+      }
+      else {
+        out      = entry.alias;
+        remapped = (r - entry.q) / (1.0f - entry.q);
+      }
+
+      remapped = std::min(remapped, one_minus_epsilon);
+      pdf      = entries[out].pdf;
+
+      return out;
+    }
+
+    inline uint32_t sample(float u, float& pdf) const {
+      float remapped;
+      return sample(u, pdf, remapped);
+    }
+  };
+
+  /**
+   * A piecewise constant distribution over the unit square, given by a
+   * grid of weights. Rows get picked from their marginal distribution,
+   * and cells from the distribution of the picked row
+   */
+  struct distribution_2d_t {
+    uint32_t width, height;
+
+    alias_table_t marginal;
+    std::vector<alias_table_t> conditional;
+
+    inline distribution_2d_t()
+      : width(0), height(0)
+    {}
+
+    /* build the distribution from 'width' x 'height' non negative
+     * weights, stored row by row */
+    inline void build(const float* weights, uint32_t w, uint32_t h) {
+      width  = w;
+      height = h;
+
+      conditional.resize(height);
+
+      std::vector<float> rows(height);
+      for (auto y=0u; y<height; ++y) {
+        conditional[y].build(weights + y * width, width);
+        rows[y] = conditional[y].total;
+      }
+
+      marginal.build(rows.data(), height);
+    }
+
+    /* sample a point in the unit square. the pdf is with respect to
+     * the area of the square */
+    inline void sample(float u, float v, float& x, float& y, float& pdf) const {
+      float pdf_row, pdf_column, rx, ry;
+
+      const auto row    = marginal.sample(v, pdf_row, ry);
+      const auto column = conditional[row].sample(u, pdf_column, rx);
+
+      x   = (column + rx) / width;
+      y   = (row + ry) / height;
+      pdf = pdf_row * pdf_column * width * height;
+    }
+
+    inline float pdf(float x, float y) const {
+      const auto column = std::min((uint32_t) (x * width), width - 1);
+      const auto row    = std::min((uint32_t) (y * height), height - 1);
+
+      return marginal.pdf(row) * conditional[row].pdf(column) * width * height;
+    }
+  };
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Progressive multi-jittered (0,2) sequences. Every power of two prefix
+ * of the sequence is stratified in all elementary intervals of its size,
+ * i.e. in all grids of 2^k x 2^(m-k) cells for 2^m points.
+ *
+ * Points are stored as 32 bit fixed point values. Generating them is too
+ * slow to do while rendering, so they get precomputed into tables
+ *
+ * See: Christensen et al., "Progressive Multi-Jittered Sample Sequences",
+ * EGSR 2018
+ */
+namespace pmj {
+  namespace details {
+    /* bookkeeping of the elementary intervals occupied by a set of
+     * 2^m points */
+    struct strata_t {
+      uint32_t m;
+      std::vector<uint8_t> occupied;
+
+      inline void reset(uint32_t bits, const uint32_t* xs, const uint32_t* ys, uint32_t num) {
+        m = bits;
+        occupied.assign((m+1) << m, 0);
+
+        for (auto i=0u; i<num; ++i) {
+          mark(xs[i] >> (32-m), ys[i] >> (32-m));
+        }
+      }
+
+      /* cell of a point with m bit coordinates in the elementary
+       * intervals with 2^k columns */
+      inline uint32_t cell(uint32_t k, uint32_t x, uint32_t y) const {
+        return (k << m) + (x >> (m-k)) + ((y >> k) << k);
+      }
+
+      inline bool is_free(uint32_t x, uint32_t y) const {
+        for (auto k=0u; k<=m; ++k) {
+          if (occupied[cell(k, x, y)]) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      inline void mark(uint32_t x, uint32_t y) {
+        for (auto k=0u; k<=m; ++k) {
+          occupied[cell(k, x, y)] = 1;
+        }
+      }
+    };
+
+    /* place a point in a quarter of a cell of a 2^b x 2^b grid, such
+     * that it doesn't share an elementary interval with any other
+     * point. returns false if the quarter has no free interval left */
+    template<typename Rng>
+    inline bool place(
+      Rng& rng
+    , strata_t& strata
+    , uint32_t b
+    , uint32_t cx
+    , uint32_t cy
+    , uint32_t& x
+    , uint32_t& y)
+    {
+      const auto m    = strata.m;
+      const auto bits = m - (b+1);
+      const auto num  = 1u << bits;
+
+      // start searching at a random position, to jitter the points
+      const auto r  = rng.next();
+      const auto sx = (uint32_t) r & (num-1);
+      const auto sy = (uint32_t) (r >> 32) & (num-1);
+
+      for (auto i=0u; i<num; ++i) {
+        const auto qx = (cx << bits) | ((sx + i) & (num-1));
+
+        // the column of the finest intervals is independent of y
+        if (strata.occupied[strata.cell(m, qx, 0)]) {
+          continue;
+        }
+
+        for (auto j=0u; j<num; ++j) {
+          const auto qy = (cy << bits) | ((sy + j) & (num-1));
+
+          if (strata.is_free(qx, qy)) {
+            strata.mark(qx, qy);
+
+            // jitter the point inside its finest stratum
+            const auto jitter = rng.next();
+            x = (qx << (32-m)) | ((uint32_t) jitter >> m);
+            y = (qy << (32-m)) | ((uint32_t) (jitter >> 32) >> m);
+
+            return true;
+          }
+        }
+      }
+
+      return false;
+    }
+
+    /* the quarter of its cell in a 2^b x 2^b grid a coordinate is in */
+    inline uint32_t quarter(uint32_t b, uint32_t x) {
+      return x >> (32 - (b+1));
+    }
+  }
+
+  /* generate 'num' points of a pmj02 sequence. 'num' must be a power of
+   * two. 'rng' must provide 64 random bits from next(). returns the
+   * number of points that could not be placed without violating the
+   * stratification, which should always be zero */
+  template<typename Rng>
+  inline uint32_t generate02(Rng& rng, uint32_t num, uint32_t* xs, uint32_t* ys) {
+    details::strata_t strata;
+
+    uint32_t failed = 0;
+
+    const auto point = [&](uint32_t b, uint32_t cx, uint32_t cy, uint32_t alt_x, uint32_t alt_y, uint32_t i) {
+      if (!details::place(rng, strata, b, cx, cy, xs[i], ys[i])) {
+        if (!details::place(rng, strata, b, alt_x, alt_y, xs[i], ys[i])) {
+          const auto r = rng.next();
+          xs[i] = (cx << (31-b)) | ((uint32_t) r >> (b+1));
+          ys[i] = (cy << (31-b)) | ((uint32_t) (r >> 32) >> (b+1));
+          ++failed;
+        }
+      }
+    };
+
+    const auto r = rng.next();
+    xs[0] = (uint32_t) r;
+    ys[0] = (uint32_t) (r >> 32);
+
+    auto n = 1u, b = 0u;
+    while (n < num) {
+      // from 4^b to 2 * 4^b points. every cell of the 2^b x 2^b grid
+      // gets a second point, in the quarter diagonally opposite of the
+      // first one
+      strata.reset(2*b+1, xs, ys, n);
+
+      for (auto s=0u; s<n && n+s < num; ++s) {
+        const auto qx = details::quarter(b, xs[s]) ^ 1;
+        const auto qy = details::quarter(b, ys[s]) ^ 1;
+        point(b, qx, qy, qx, qy, n+s);
+      }
+
+      n *= 2;
+
+      if (n >= num) {
+        break;
+      }
+
+      // from 2 * 4^b to 4^(b+1) points. the two empty quarters of
+      // every cell get filled. a random one first, for all cells,
+      // and then the remaining one
+      strata.reset(2*b+2, xs, ys, n);
+
+      const auto half = n / 2;
+
+      for (auto s=0u; s<half && n+s < num; ++s) {
+        auto qx = details::quarter(b, xs[s]);
+        auto qy = details::quarter(b, ys[s]);
+
+        if (rng.next() & 1) {
+          point(b, qx ^ 1, qy, qx, qy ^ 1, n+s);
+        }
+        else {
+          point(b, qx, qy ^ 1, qx ^ 1, qy, n+s);
+        }
+      }
+
+      for (auto s=0u; s<half && n+half+s < num; ++s) {
+        const auto qx = details::quarter(b, xs[n+s]) ^ 1;
+        const auto qy = details::quarter(b, ys[n+s]) ^ 1;
+        point(b, qx, qy, qx, qy, n+half+s);
+      }
+
+      n *= 2;
+      b += 1;
+    }
+
+    return failed;
+  }
+}
@@ -4,6 +4,28 @@
 #include "vector.hpp"
 
 namespace simd {
+  /* N boxes, quantized to 8 bit per plane, relative to a common
+   * origin, and step size */
+  template<int N>
+  struct quantized_aabb_t {
+    const uint8_t* const bounds;
+    const float*   const origin;
+    const float*   const scale;
+
+    inline quantized_aabb_t(
+      const uint8_t* const bounds
+    , const float* const origin
+    , const float* const scale)
+      : bounds(bounds), origin(origin), scale(scale)
+    {}
+  };
+
+  /* expand 8 quantized values to floats */
+  inline __m256 dequantize(const uint8_t* const q, float origin, float scale) {
+    const auto i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) q));
+    return madd(_mm256_cvtepi32_ps(i), load(scale), load(origin));
+  }
+
   template<int N>
   struct aabb_t {
     vector3_t<N> min, max;
@@ -12,6 +34,17 @@ namespace simd {
       : min(&(bounds[0*N]), &(bounds[1*N]), &(bounds[2*N]))
       , max(&(bounds[3*N]), &(bounds[4*N]), &(bounds[5*N]))
     {}
+
+    inline aabb_t(const quantized_aabb_t<N>& q)
+      : min(
+          dequantize(q.bounds + 0*N, q.origin[0], q.scale[0])
+        , dequantize(q.bounds + 1*N, q.origin[1], q.scale[1])
+        , dequantize(q.bounds + 2*N, q.origin[2], q.scale[2]))
+      , max(
+          dequantize(q.bounds + 3*N, q.origin[0], q.scale[0])
+        , dequantize(q.bounds + 4*N, q.origin[1], q.scale[1])
+        , dequantize(q.bounds + 5*N, q.origin[2], q.scale[2]))
+    {}
   };
 
   template<int N>
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The first two dimensions of the Sobol sequence, with hash based
+ * Owen scrambling. Higher dimensions are built by padding 2d samples,
+ * and decorrelating them with a shuffled index, and a different
+ * scramble per dimension.
+ *
+ * See: Burley, "Practical Hash-based Owen Scrambling", JCGT 2020
+ */
+namespace sobol {
+  inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+    x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+    return (x >> 16) | (x << 16);
+  }
+
+  /* bit i of the result only depends on bits 0..i of the input */
+  inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return x;
+  }
+
+  /* owen scrambling. every bit gets flipped based on the bits above
+   * it. applied to a sample index, this shuffles the index inside
+   * aligned blocks of powers of two, so prefixes of the sequence keep
+   * their stratification */
+  inline uint32_t scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x = laine_karras_permutation(x, seed);
+    return reverse_bits(x);
+  }
+
+  /* van der corput sequence */
+  inline uint32_t sample0(uint32_t i) {
+    return reverse_bits(i);
+  }
+
+  inline uint32_t sample1(uint32_t i) {
+    uint32_t out = 0;
+    for (uint32_t v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1) {
+      if (i & 1) {
+        out ^= v;
+      }
+    }
+    return out;
+  }
+
+  /* scrambled 2d sample of the sequence, as 32 bit fixed point values.
+   * 'seed' selects one of many decorrelated sequences */
+  inline void sample2(uint32_t i, uint32_t seed, uint32_t& x, uint32_t& y) {
+    i = scramble(i, seed);
+    x = scramble(sample0(i), seed ^ 0xa511e9b3);
+    y = scramble(sample1(i), seed ^ 0x63d83595);
+  }
+}
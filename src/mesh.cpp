@@ -127,6 +127,14 @@ void mesh_t::triangles(uint32_t set, std::vector<triangle_t>& out) const {
   }
 }
 
+Imath::Box3f mesh_t::bounds() const {
+  Imath::Box3f out;
+  for (const auto& v : details->vertices) {
+    out.extendBy(v);
+  }
+  return out;
+}
+
 simd::int32v_t mesh_t::face_ids(uint32_t setid, const simd::int32v_t& indices) const {
   const auto& set = details->sets[setid];
   const auto face_indices = simd::int32v_t((int32_t*) set.faces, indices);
@@ -315,6 +323,23 @@ Imath::V3f triangle_t::barycentric_to_point(const Imath::V2f& uv) const {
   return uv.x * a() + uv.y * b() + (1-uv.x-uv.y) * c();
 }
 
+Imath::V2f triangle_t::barycentric_to_st(const Imath::V2f& uv) const {
+  if (mesh->details->uvs.size() == 0) {
+    return Imath::V2f(0);
+  }
+
+  auto uva = mesh->faces[face], uvb = mesh->faces[face+1], uvc = mesh->faces[face+2];
+
+  if (!mesh->has_per_vertex_uvs()) {
+    uva = face;
+    uvb = face+1;
+    uvc = face+2;
+  }
+
+  const auto& uvs = mesh->uvs;
+  return uv.x * uvs[uva] + uv.y * uvs[uvb] + (1-uv.x-uv.y) * uvs[uvc];
+}
+
 Imath::V2f triangle_t::sample(const Imath::V2f& uv) {
   const auto x = std::sqrt(uv.x);
   const auto u = 1 - x;
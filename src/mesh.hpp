@@ -3,6 +3,7 @@
 #include "state.hpp"
 #include "triangle.hpp"
 
+#include <ImathBox.h>
 #include <ImathVec.h>
 
 #include <vector>
@@ -103,6 +104,9 @@ struct mesh_t {
   /* get the area of a specific triangle of the mesh */
   float area(uint32_t face) const;
 
+  /* bounds of all vertices of the mesh */
+  Imath::Box3f bounds() const;
+
   simd::vector3v_t barycentrics_to_point(
     uint32_t setid
   , const simd::int32v_t& indices                                            
@@ -7,9 +7,20 @@ struct parsed_options_t {
   static const uint32_t DEFAULT_SAMPLES_PER_PIXEL = 16;
   static const uint32_t DEFAULT_PATH_DEPTH = 9;
   static const uint32_t DEFAULT_PATHS_PER_SAMPLE = 16;
+  static const uint32_t DEFAULT_MIN_SAMPLES = 16;
+  static const uint32_t DEFAULT_MAX_SAMPLES = 1024;
+  static const uint32_t DEFAULT_TILE_SIZE = 32;
 
   std::string scene;
   std::string output;
+  // directory to cache built acceleration structures in.
+  // caching is disabled if this is empty
+  std::string bvh_cache;
+  // sequence used for pixel, lens, light, and bsdf samples.
+  // one of "random", "sobol", or "pmj02"
+  std::string sampler;
+  // order tiles are rendered in. one of "rows", "hilbert", or "spiral"
+  std::string tile_order;
 
   // only use one host thread
   bool single_threaded;
@@ -18,26 +29,91 @@ struct parsed_options_t {
   // render in progressive mode, rather than tiled
   // (i.e. send full frame tiles, representing one sample each, into the pipeline)
   bool progressive;
+  // pixel samples rendered over the whole frame per progressive pass
+  uint32_t samples_per_pass;
+  // minimum time between intermediate images in progressive mode,
+  // in seconds
+  float publish_interval;
   // render a separate output for normals
   bool render_normals;
   // print statistics while rendering
   bool verbose;
   // number of pixel samples.
-  // if set to 0, sampling is adaptive (not supported yet)
+  // if set to 0, sampling is adaptive
   uint32_t samples_per_pixel;
+  // with adaptive sampling, every pixel gets at least, and at most
+  // this many paths. pixels stop getting paths in between, once the
+  // relative standard error of their mean luminance drops below the
+  // noise threshold
+  uint32_t min_samples;
+  uint32_t max_samples;
+  float noise_threshold;
+  // stop starting new samples after this many seconds, and finish the
+  // frame with the samples taken so far. 0 renders without a limit
+  float time_limit;
   // paths traced per image sample
   uint32_t paths_per_sample;
   // maximum depth of traced paths
   uint32_t path_depth;
+  // build the BVH with spatial splits (SBVH)
+  bool spatial_splits;
+  // trace against a BVH with quantized node bounds
+  bool compress_bvh;
+  // ray streams smaller than this continue with single ray traversal.
+  // 0 always traces streams
+  uint32_t stream_threshold;
+  // sort secondary rays by direction and origin before tracing them
+  bool sort_rays;
+  // seed for all random numbers used while rendering. renders with
+  // the same seed produce the same image
+  uint32_t seed;
+  // pick lights for light samples with a light tree, based on their
+  // contribution at the shading point, instead of by power only
+  bool light_tree;
+  // start new paths in a tile as soon as others terminate, to keep
+  // ray streams full
+  bool regenerate_paths;
+  // shade all hit points with the same material at once, instead of
+  // running the shading system for every point separately
+  bool batch_shading;
+  // evaluate bsdfs of hit points with the same lobes in simd packets
+  bool packet_bsdfs;
+  // restrict every render thread to one cpu, filling one numa node
+  // after the other
+  bool pin_threads;
+  // give every numa node its own copy of the BVH. implies pinning
+  bool replicate_bvh;
+  // width, and height of the tiles the image is rendered in
+  uint32_t tile_size;
 
   inline parsed_options_t()
     : output("out.exr")
+    , sampler("sobol")
+    , tile_order("hilbert")
     , single_threaded(false)
     , progressive(false)
+    , samples_per_pass(1)
+    , publish_interval(1.0f)
     , render_normals(false)
     , verbose(false)
     , samples_per_pixel(DEFAULT_SAMPLES_PER_PIXEL)
+    , min_samples(DEFAULT_MIN_SAMPLES)
+    , max_samples(DEFAULT_MAX_SAMPLES)
+    , noise_threshold(0.01f)
+    , time_limit(0.0f)
     , paths_per_sample(DEFAULT_PATHS_PER_SAMPLE)
     , path_depth(DEFAULT_PATH_DEPTH)
+    , spatial_splits(false)
+    , compress_bvh(false)
+    , stream_threshold(0)
+    , sort_rays(false)
+    , seed(0)
+    , light_tree(false)
+    , regenerate_paths(false)
+    , batch_shading(true)
+    , packet_bsdfs(true)
+    , pin_threads(false)
+    , replicate_bvh(false)
+    , tile_size(DEFAULT_TILE_SIZE)
   {}
 };
@@ -1,180 +1,346 @@
 #include "sampling.hpp"
 #include "light.hpp"
 #include "scene.hpp"
+#include "accel/light_tree.hpp"
 #include "math/sampling.hpp"
+#include "math/pmj.hpp"
+#include "math/sobol.hpp"
 
 #include <atomic>
 #include <cmath>
 #include <cstdlib>
+#include <iostream>
 #include <limits>
-#include <random> 
-#include <functional>
+#include <string>
+#include <vector>
 
-/* random number engine, that complies with the c++ standard */
-struct xoroshiro128plus_t {
-  typedef uint64_t result_type;
+struct sampler_t::details_t {
+  static const uint32_t NUM_LIGHT_SAMPLE_SETS = 64;
 
-  static uint64_t min() {
-    return std::numeric_limits<uint64_t>::min();
-  }
+  // precomputed pmj02 sequences. pixels, and dimensions pick one of
+  // these tables, and scramble it
+  static const uint32_t NUM_PMJ02_TABLES = 16;
+  static const uint32_t NUM_PMJ02_SAMPLES = 4096;
 
-  static uint64_t max() {
-    return std::numeric_limits<uint64_t>::max();
-  }
+  // only used while preprocessing on a single thread
+  sampling::rng_t rng;
 
-  inline uint64_t rotl (uint64_t a, int w) {
-    return a << w | a >> (64-w);
-  }
+  // hashed seed, that pixel, and dimension hashes are derived from
+  uint64_t key;
 
-  uint64_t operator()() {
-   static uint64_t s0 = 1451815097307991481;
-   static uint64_t s1 = 5520930533486498032;
+  std::vector<uint32_t> pmj02;
 
-   const uint64_t result = s0 + s1;
+  // picks lights based on their contribution at a shading point.
+  // only built if enabled
+  accel::light_tree_t* light_tree;
+  // the tree only contains lights with a position. maps lights in
+  // the tree to lights in the scene, and back
+  std::vector<uint32_t> tree_lights;
+  std::vector<uint32_t> tree_items;
+  // infinite lights can't be bounded. with a light tree they get
+  // picked with a probability based on their power instead
+  const light_t* environment;
+  float environment_probability;
 
-   s1 ^= s0;
-   s0 = rotl(s0, 55) ^ s1 ^ (s1 << 14);
-   s1 = rotl(s1, 36);
+  std::atomic<uint32_t> light_sample;
+
+  inline details_t(uint32_t seed)
+    : rng(seed)
+    , key(sampling::rng_t::mix(seed))
+    , light_tree(nullptr)
+    , environment(nullptr)
+    , environment_probability(0.0f)
+    , light_sample(0)
+  {}
 
-   return result;
+  inline ~details_t() {
+    delete light_tree;
   }
-};
 
-struct sampler_t::details_t {
-  static const uint32_t NUM_LIGHT_SAMPLE_SETS = 64;
+  void build_light_tree(const scene_t& scene) {
+    std::vector<accel::light_tree_t::item_t> items;
 
-  // xoroshiro128plus_t gen;
-  std::mt19937 gen;
-  std::uniform_real_distribution<float> dis;
+    tree_lights.clear();
+    tree_items.assign(scene.num_lights(), 0);
 
-  std::atomic<uint32_t> light_sample;
+    auto total = 0.0f;
+    for (auto i=0; i<scene.num_lights(); ++i) {
+      const auto light = scene.light(i);
 
-  inline details_t()
-    : light_sample(0)
-    , dis(0.0f, 1.0f)
-  {}
+      total += light->power();
 
-  inline float to_float(uint32_t x) {
-    auto bits = (x & 0x00ffffff) | 0x3f800000;
-    return *((float*) &bits) - 1.0f;
-  }
+      if (light->is_infinite()) {
+        continue;
+      }
 
-  inline float sample() {
-    // return to_float((uint32_t) gen());
-    return dis(gen);
-  }
+      tree_items[i] = items.size();
+      tree_lights.push_back(i);
+
+      items.push_back({
+        light->bounds()
+      , { light->axis(), light->cos_theta() }
+      , light->power() });
+    }
 
-  inline Imath::V2f sample2() {
-    // uint64_t x = gen();
-    // return { to_float((uint32_t) x), to_float((uint32_t) (x >> 32)) };
-    return { dis(gen), dis(gen) };
+    environment = scene.environment();
+    environment_probability = environment && total > 0.0f
+      ? environment->power() / total
+      : 0.0f;
+
+    light_tree = new accel::light_tree_t();
+    light_tree->build(items);
+
+    std::cout
+      << "Built light tree: " << light_tree->nodes.size()
+      << " nodes, for " << items.size() << " lights"
+      << std::endl;
   }
 
   inline uint32_t next_light_sample_set() {
     return light_sample++ & (NUM_LIGHT_SAMPLE_SETS-1);
   }
+
+  inline uint32_t hash(uint32_t pixel, uint32_t dimension) const {
+    return (uint32_t) sampling::rng_t::mix(key ^ (((uint64_t) pixel << 32) | dimension));
+  }
+
+  void generate_pmj02_tables() {
+    pmj02.resize(NUM_PMJ02_TABLES * NUM_PMJ02_SAMPLES * 2);
+
+    std::vector<uint32_t> xs(NUM_PMJ02_SAMPLES), ys(NUM_PMJ02_SAMPLES);
+
+    for (auto i=0; i<NUM_PMJ02_TABLES; ++i) {
+      pmj::generate02(rng, NUM_PMJ02_SAMPLES, xs.data(), ys.data());
+
+      auto table = &pmj02[i * NUM_PMJ02_SAMPLES * 2];
+      for (auto j=0; j<NUM_PMJ02_SAMPLES; ++j) {
+        table[2*j+0] = xs[j];
+        table[2*j+1] = ys[j];
+      }
+    }
+  }
+
+  /* xor scrambling shuffles the strata of a (0,2) sequence, so
+   * scrambled tables keep their stratification */
+  inline void pmj02_sample(uint32_t sample, uint32_t hash, uint32_t& x, uint32_t& y) const {
+    const auto table = (hash + sample / NUM_PMJ02_SAMPLES) & (NUM_PMJ02_TABLES-1);
+    const auto i = table * NUM_PMJ02_SAMPLES + (sample & (NUM_PMJ02_SAMPLES-1));
+
+    x = pmj02[2*i+0] ^ (hash * 0x9e3779b9);
+    y = pmj02[2*i+1] ^ (hash * 0x85ebca6b);
+  }
 };
 
+static sampling::sequence_t parse_sequence(const std::string& name) {
+  if (name == "random") {
+    return sampling::RANDOM;
+  }
+  else if (name == "sobol") {
+    return sampling::SOBOL;
+  }
+  else if (name == "pmj02") {
+    return sampling::PMJ02;
+  }
+
+  std::cerr
+    << "Unknown sampler: " << name << ", using sobol" << std::endl;
+  return sampling::SOBOL;
+}
+
 sampler_t::sampler_t(parsed_options_t& options)
-  : details(new details_t())
+  : details(new details_t(options.seed))
+  , light_samples(nullptr)
   , spp(options.samples_per_pixel)
-{}
+  , seed(options.seed)
+  , sequence(parse_sequence(options.sampler))
+  , light_tree(options.light_tree)
+{
+  if (sequence == sampling::PMJ02) {
+    details->generate_pmj02_tables();
+  }
+}
 
 sampler_t::~sampler_t() {
-  delete pixel_samples;
-  delete light_samples;
+  free(light_samples);
   delete details;
 }
 
 void sampler_t::preprocess(const scene_t& scene) {
 #ifdef aligned_alloc
-  pixel_samples = (pixel_samples_t*) aligned_alloc(32, sizeof(pixel_sample_t<>) * spp);
   light_samples = (light_samples_t*) aligned_alloc(32, sizeof(light_sample_t<>) * details_t::NUM_LIGHT_SAMPLE_SETS);
 #else
-  posix_memalign((void**) &pixel_samples, 32, sizeof(pixel_samples_t) * spp);
   posix_memalign((void**) &light_samples, 32, sizeof(light_samples_t) * details_t::NUM_LIGHT_SAMPLE_SETS);
 #endif
 
-  const auto spd = (uint32_t) std::lroundf(std::sqrt(spp));
-
-  Imath::V2f stratified[spp];
-  sample::stratified_2d([this]() { return details->sample(); }, stratified, spd);
+  auto& rng = details->rng;
 
-  for (auto i=0; i<spp; ++i) {
-    for (auto j=0; j<128; ++j) {
-      for (auto k=0; k<8; ++k) {
-      	pixel_samples[i].film[j].x[k] = stratified[i].x;
-      	pixel_samples[i].film[j].y[k] = stratified[i].y;
-        pixel_samples[i].lens[j].x[k] = sample();
-        pixel_samples[i].lens[j].y[k] = sample();
-      }
-    }
+  if (light_tree) {
+    delete details->light_tree;
+    details->light_tree = nullptr;
+    details->build_light_tree(scene);
   }
 
-  const auto nlights = scene.num_lights();
-
-  static uint32_t stats[8] = {0,0,0,0,0,0,0,0};
-
   for (auto i=0; i<details_t::NUM_LIGHT_SAMPLE_SETS; i++) {
     for (auto j=0; j<light_samples_t::size/light_samples_t::step; ++j) {
       for (auto k=0; k<light_samples_t::step; ++k) {
-        const auto l = std::min((uint32_t) std::floor(sample() * nlights), nlights - 1);
-        const auto light = scene.light(l);
-
-        stats[l]++;
+        float pdf;
+        const auto light = scene.sample_light(rng.sample(), pdf);
 
         light_sample_t sample;
-        light->sample(details->sample2(), sample);
+        light->sample(rng.sample2(), sample);
+
+        if (light->is_infinite()) {
+          sample.p = light->outside(light->bounds().center(), sample.p);
+        }
 
         auto& out = light_samples[i].samples[j];
         out.p.from(k, sample.p);
         out.u[k] = sample.uv.x;
         out.v[k] = sample.uv.y;
-        out.pdf[k] = sample.pdf / nlights;
+        out.pdf[k] = sample.pdf * pdf;
         out.mesh[k] = sample.mesh;
         out.face[k] = sample.face;
       }
     }
   }
+}
 
-  for(auto i=0; i<8;++i) {
-    std::cout << stats[i] << ", " << std::endl; 
-  }
+const sampler_t::light_samples_t& sampler_t::next_light_samples() {
+  const auto set = details->next_light_sample_set();
+  const auto& samples = light_samples[set];
+
+  return samples;
 }
 
-float sampler_t::sample() {
-  return details->sample();
+float sampler_t::light_pdf(
+  const scene_t* scene
+, const Imath::V3f& p
+, const Imath::V3f& n
+, const light_t* light) const
+{
+  if (details->light_tree) {
+    const auto environment = details->environment_probability;
+
+    if (light->is_infinite()) {
+      return environment;
+    }
+
+    const auto item = details->tree_items[light->id];
+    return details->light_tree->pdf(p, n, item) * (1.0f - environment);
+  }
+  return scene->light_pdf(light);
 }
 
-Imath::V2f sampler_t::sample2() {
-  return details->sample2();
+Imath::V2f sampler_t::sample2(
+  uint32_t pixel
+, uint32_t sample
+, uint32_t dimension) const
+{
+  uint32_t x, y;
+
+  switch (sequence) {
+  case sampling::SOBOL:
+    sobol::sample2(sample, details->hash(pixel, dimension), x, y);
+    break;
+  case sampling::PMJ02:
+    details->pmj02_sample(sample, details->hash(pixel, dimension), x, y);
+    break;
+  default:
+    return rng(pixel, sample, dimension).sample2();
+  }
+
+  return {
+    sampling::rng_t::to_float(x >> 8)
+  , sampling::rng_t::to_float(y >> 8)
+  };
 }
 
-const sampler_t::light_samples_t& sampler_t::next_light_samples() {
-  const auto set = details->next_light_sample_set();
-  const auto& samples = light_samples[set];
+void sampler_t::pixel_samples(
+  const uint32_t* pixels
+, const uint32_t* samples
+, uint32_t num
+, pixel_samples_t& out) const
+{
+  using namespace sampling;
 
-  return samples;
+  for (auto i=0; i<num; ++i) {
+    const auto j = i / pixel_samples_t::step;
+    const auto k = i % pixel_samples_t::step;
+
+    out.film[j].from(k, sample2(pixels[i], samples[i], dimension::FILM));
+    out.lens[j].from(k, sample2(pixels[i], samples[i], dimension::LENS));
+  }
 }
 
-void sampler_t::fresh_light_samples(const scene_t* scene, light_samples_t& out) {
-  const auto nlights = scene->num_lights();
+void sampler_t::fresh_light_samples(
+  const scene_t* scene
+, const float* select
+, const Imath::V2f* uv
+, const Imath::V3f* p
+, const Imath::V3f* n
+, uint32_t num
+, light_samples_t& out) const
+{
+  static const float one_minus_epsilon =
+    1.0f - std::numeric_limits<float>::epsilon();
+
+  const auto tree = details->light_tree;
+  const auto environment = details->environment_probability;
+
+  for (auto i=0; i<num; ++i) {
+    const auto j = i / light_samples_t::step;
+    const auto k = i % light_samples_t::step;
+
+    float pdf;
+    const light_t* light = nullptr;
+
+    if (tree) {
+      if (select[i] < environment) {
+        light = details->environment;
+        pdf   = environment;
+      }
+      else {
+        const auto u = std::min(
+          (select[i] - environment) / (1.0f - environment), one_minus_epsilon);
+
+        uint32_t index;
+        if (tree->sample(p[i], n[i], u, index, pdf)) {
+          light = scene->light(details->tree_lights[index]);
+          pdf  *= 1.0f - environment;
+        }
+      }
+    }
+    else {
+      light = scene->sample_light(select[i], pdf);
+    }
 
-  for (auto j=0; j<light_samples_t::size/light_samples_t::step; ++j) {
-    for (auto k=0; k<light_samples_t::step; ++k) {
-      const auto l = std::min((uint32_t) std::floor(sample() * nlights), nlights - 1);
-      const auto light = scene->light(l);
+    auto& s = out.samples[j];
+
+    if (!light) {
+      // the tree walk ended at a node whose children can't contribute
+      // at this point. the lights below it get no sample, and a pdf of
+      // zero keeps other lights from being counted twice
+      s.p.from(k, p[i] + n[i]);
+      s.u[k] = 0.0f;
+      s.v[k] = 0.0f;
+      s.pdf[k] = 0.0f;
+      s.mesh[k] = ENVIRONMENT;
+      s.face[k] = 0;
+      continue;
+    }
 
-      light_sample_t sample;
-      light->sample(details->sample2(), sample);
+    light_sample_t sample;
+    light->sample(uv[i], sample);
 
-      auto& s = out.samples[j];
-      s.p.from(k, sample.p);
-      s.u[k] = sample.uv.x;
-      s.v[k] = sample.uv.y;
-      s.pdf[k] = sample.pdf / nlights;
-      s.mesh[k] = sample.mesh;
-      s.face[k] = sample.face;
+    if (light->is_infinite()) {
+      sample.p = light->outside(p[i], sample.p);
     }
+
+    s.p.from(k, sample.p);
+    s.u[k] = sample.uv.x;
+    s.v[k] = sample.uv.y;
+    s.pdf[k] = sample.pdf * pdf;
+    s.mesh[k] = sample.mesh;
+    s.face[k] = sample.face;
   }
 }
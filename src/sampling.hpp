@@ -8,9 +8,104 @@
 #include "utils/assert.hpp"
 #include "utils/compiler.hpp"
 
+struct light_t;
 struct scene_t;
 
 namespace sampling {
+  /* xoroshiro128+ random number generator. the state is small, and owned
+   * by whoever draws samples from it, so render threads never share a
+   * generator. random render samples come from a generator seeded per
+   * pixel, sample, and dimension, which makes images reproducible
+   * independent of the number of threads, and how tiles are split and
+   * rendered */
+  struct rng_t {
+    uint64_t s0, s1;
+
+    inline rng_t(uint64_t seed = 0) {
+      reset(seed);
+    }
+
+    /* splitmix64 finalizer, to turn counters into well distributed seeds */
+    static inline uint64_t mix(uint64_t x) {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+      return x ^ (x >> 31);
+    }
+
+    static inline uint64_t rotl(uint64_t x, int k) {
+      return (x << k) | (x >> (64 - k));
+    }
+
+    inline void reset(uint64_t seed) {
+      s0 = mix(seed + 0x9e3779b97f4a7c15ull);
+      s1 = mix(seed + 0x3c6ef372fe94f82aull);
+    }
+
+    /* seed the generator for one of many independent streams */
+    inline void reset(uint64_t seed, uint64_t stream) {
+      reset(mix(seed) ^ stream);
+    }
+
+    inline uint64_t next() {
+      const auto a = s0;
+      auto b = s1;
+      const auto result = a + b;
+
+      b ^= a;
+      s0 = rotl(a, 24) ^ b ^ (b << 16);
+      s1 = rotl(b, 37);
+
+      return result;
+    }
+
+    /* uniform float in [0, 1), from 24 random bits. the low bits of
+     * xoroshiro128+ are the weakest, so they are never used */
+    static inline float to_float(uint64_t x) {
+      return (float) (x & 0xffffff) * (1.0f / 16777216.0f);
+    }
+
+    inline float sample() {
+      return to_float(next() >> 40);
+    }
+
+    inline Imath::V2f sample2() {
+      const auto x = next();
+      return { to_float(x >> 40), to_float(x >> 16) };
+    }
+
+    template<int N>
+    inline void sample2(soa::vector2_t<N>& out) {
+      for (auto i=0; i<N; ++i) {
+        out.from(i, sample2());
+      }
+    }
+  };
+
+  /* sequences samples can be drawn from */
+  enum sequence_t {
+    RANDOM,
+    SOBOL,
+    PMJ02
+  };
+
+  /* the sample dimensions used to render a path. all dimensions are two
+   * dimensional. every path vertex uses its own set of dimensions */
+  namespace dimension {
+    static const uint32_t FILM = 0;
+    static const uint32_t LENS = 1;
+
+    // dimensions at a path vertex
+    static const uint32_t LIGHT = 0;  // point on a light source
+    static const uint32_t SELECT = 1; // x: light selection, y: russian roulette
+    static const uint32_t BSDF = 2;   // sampled direction
+
+    static const uint32_t PER_VERTEX = 3;
+
+    inline uint32_t vertex(uint32_t depth, uint32_t dimension) {
+      return 2 + depth * PER_VERTEX + dimension;
+    }
+  }
+
   namespace details {
     template<int N>
     struct pixel_samples_t {
@@ -22,6 +117,7 @@ namespace sampling {
     };
 
     struct light_sample_t {
+      // the sampled point. infinite lights sample a direction instead
       Imath::V3f p;
       Imath::V2f uv;
       uint32_t mesh;
@@ -35,7 +131,7 @@ namespace sampling {
       static const uint32_t size=N;
       static const uint32_t step=SIMD_WIDTH;
       
-      struct {
+      struct packet_t {
         soa::vector3_t<step> p;
         float u[step];
         float v[step];
@@ -62,26 +158,31 @@ struct sampler_t {
 
   // typedef soa::vector2_t<config::STREAM_SIZE> samples2d_t;
 
-  pixel_samples_t* pixel_samples;
   light_samples_t* light_samples;
 
   const uint32_t spp;
+  // seeds all random number generators used for a frame
+  const uint32_t seed;
+  // the sequence pixel, lens, light, and bsdf samples come from
+  const sampling::sequence_t sequence;
+  // pick lights with a light tree
+  const bool light_tree;
 
   sampler_t(parsed_options_t& options);
   ~sampler_t();
 
   void preprocess(const scene_t& scene);
 
-  float sample();
-  
-  Imath::V2f sample2();
-
-  template<int N>
-  inline void sample2(soa::vector2_t<N>& out) {
-    for (auto i=0; i<N; ++i) {
-      const auto sample = sample2();
-      out.from(i, sample);
-    }
+  /* a generator for a dimension of a sample of a pixel. this only
+   * depends on the seed, the pixel, the sample index, and the
+   * dimension, so it doesn't matter which thread renders the pixel, or
+   * how the image was split into tiles */
+  inline sampling::rng_t rng(uint32_t pixel, uint32_t sample, uint32_t dimension) const {
+    sampling::rng_t out;
+    out.reset(
+      sampling::rng_t::mix(((uint64_t) dimension << 32) | seed)
+    , ((uint64_t) sample << 32) | pixel);
+    return out;
   }
 
   /** create a precomputed set of 1d samples */
@@ -90,14 +191,43 @@ struct sampler_t {
   /** create a precomputed set of 2d samples */
   // uint32_t request_2d_samples();
   
-  inline const pixel_samples_t& next_pixel_samples(uint32_t i) const {
-    assert(i < spp);
-    return pixel_samples[i];
-  }
+  /* a 2d sample from the sampler's sequence, for a dimension of a
+   * sample of a pixel. every pixel, and every dimension get their own
+   * decorrelated sequence */
+  Imath::V2f sample2(
+    uint32_t pixel
+  , uint32_t sample
+  , uint32_t dimension) const;
+
+  /* film, and lens samples for a set of samples of pixels */
+  void pixel_samples(
+    const uint32_t* pixels
+  , const uint32_t* samples
+  , uint32_t num
+  , pixel_samples_t& out) const;
 
   const light_samples_t& next_light_samples();
 
-  void fresh_light_samples(const scene_t* scene, light_samples_t& out);
+  /* sample a point on a light for 'num' paths. lights are chosen with
+   * the 1d samples in 'select', and the points with the 2d samples in
+   * 'uv'. with a light tree, lights are chosen based on their expected
+   * contribution at the shading points 'p' with normals 'n'. otherwise
+   * proportional to their power */
+  void fresh_light_samples(
+    const scene_t* scene
+  , const float* select
+  , const Imath::V2f* uv
+  , const Imath::V3f* p
+  , const Imath::V3f* n
+  , uint32_t num
+  , light_samples_t& out) const;
+
+  /* the probability of picking a light at a shading point */
+  float light_pdf(
+    const scene_t* scene
+  , const Imath::V3f& p
+  , const Imath::V3f& n
+  , const light_t* light) const;
 
   // const float* next_1d_samples(uint32_t id);
 
@@ -2,6 +2,7 @@
 #include "light.hpp"
 #include "material.hpp"
 #include "mesh.hpp"
+#include "math/distribution.hpp"
 #include "utils/assert.hpp"
 
 #include <unordered_map>
@@ -11,8 +12,18 @@ struct scene_t::details_t {
   std::vector<material_t*> materials;
   std::vector<light_t*>    lights;
 
+  // the environment is sampled like any other light, and
+  // is also part of 'lights'
   light_t* env;
 
+  // picks lights proportional to their power
+  sample::alias_table_t light_distribution;
+
+  // area lights by the mesh, and the face they emit from. a mesh can
+  // have several face sets with the same material, so faces are mapped
+  // to lights one by one
+  std::vector<std::vector<light_t*>> emitters;
+
   std::unordered_map<std::string, material_t*> materials_by_name;
 };
 
@@ -40,8 +51,8 @@ void scene_t::reset() {
   details->materials.clear();
   details->materials_by_name.clear();
   details->lights.clear();
+  details->emitters.clear();
 
-  delete details->env;
   details->env = nullptr;
 }
 
@@ -50,9 +61,31 @@ void scene_t::preprocess() {
     mesh->preprocess(this);
   }
 
+  // lights evaluate their materials to estimate their power
+  material_t::attach();
+
+  details->emitters.clear();
+  details->emitters.resize(details->meshes.size());
+
+  std::vector<float> power;
+  std::vector<uint32_t> faces;
   for (auto& light: details->lights) {
     light->preprocess(this);
+    power.push_back(light->power());
+
+    uint32_t mesh;
+    faces.clear();
+    if (light->faces(mesh, faces)) {
+      auto& emitters = details->emitters[mesh];
+      emitters.resize(details->meshes[mesh]->num_faces, nullptr);
+
+      for (auto face : faces) {
+        emitters[face / 3] = light;
+      }
+    }
   }
+
+  details->light_distribution.build(power.data(), power.size());
 }
 
 void scene_t::triangles(std::vector<triangle_t>& out) const {
@@ -62,18 +95,23 @@ void scene_t::triangles(std::vector<triangle_t>& out) const {
 }
 
 void scene_t::add(light_t* light) {
-  light->id = details->lights.size();
-
   if (light->is_infinite()) {
     std::cout << "Setting environment light source" << std::endl;
     if (details->env) {
       std::cerr << "Overwriting existing environment light" << std::endl;
+
+      light->id = details->env->id;
+      details->lights[light->id] = light;
+
+      delete details->env;
+      details->env = light;
+      return;
     }
     details->env = light;
   }
-  else {
-    details->lights.push_back(light);
-  }
+
+  light->id = details->lights.size();
+  details->lights.push_back(light);
 }
 
 void scene_t::add(mesh_t* mesh) {
@@ -105,6 +143,24 @@ light_t* scene_t::light(uint32_t index) const {
   return details->lights[index];
 }
 
+light_t* scene_t::sample_light(float u, float& pdf) const {
+  const auto i = details->light_distribution.sample(u, pdf);
+  return details->lights[i];
+}
+
+float scene_t::light_pdf(const light_t* light) const {
+  return details->light_distribution.pdf(light->id);
+}
+
+light_t* scene_t::emitter(uint32_t mesh, uint32_t face) const {
+  if (mesh >= details->emitters.size()) {
+    return nullptr;
+  }
+
+  const auto& emitters = details->emitters[mesh];
+  return face / 3 < emitters.size() ? emitters[face / 3] : nullptr;
+}
+
 mesh_t* scene_t::mesh(uint32_t index) const {
   assert(index < details->meshes.size());
   return details->meshes[index];
@@ -126,3 +182,11 @@ material_t* scene_t::material(const std::string& name) const {
 light_t* scene_t::environment() const {
   return details->env;
 }
+
+Imath::Box3f scene_t::bounds() const {
+  Imath::Box3f out;
+  for (const auto& mesh: details->meshes) {
+    out.extendBy(mesh->bounds());
+  }
+  return out;
+}
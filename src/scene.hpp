@@ -41,8 +41,22 @@ struct scene_t {
 
   light_t* light(uint32_t index) const;
 
+  /* pick a light with a probability proportional to its power */
+  light_t* sample_light(float u, float& pdf) const;
+
+  /* the probability of picking a light with sample_light */
+  float light_pdf(const light_t* light) const;
+
+  /* the light emitting from a face of a mesh. faces are given as
+   * offsets into the mesh's indices, like rays store the face they
+   * hit */
+  light_t* emitter(uint32_t mesh, uint32_t face) const;
+
   light_t* environment() const;
 
+  /* bounds of all meshes in the scene */
+  Imath::Box3f bounds() const;
+
   mesh_t* mesh(uint32_t index) const;
 
   material_t* material(uint32_t index) const;
@@ -35,6 +35,9 @@ static const uint32_t MASKED   = (1 << 1);
 static const uint32_t SHADOW   = (1 << 2);
 static const uint32_t SPECULAR = (1 << 3);
 
+// mesh id of shadow rays, that point towards an infinite light
+static const uint32_t ENVIRONMENT = 0xffff;
+
 /* A stream of rays */
 template<int N = config::STREAM_SIZE>
 struct ray_t {
@@ -166,6 +169,10 @@ struct ray_t {
   inline uint32_t matid(uint32_t i) const {
     return (mesh[i] & 0xffff0000) >> 16;
   }
+
+  inline bool is_environment(uint32_t i) const {
+    return meshid(i) == ENVIRONMENT;
+  }
 };
 
 /* A stream of surface interactions
@@ -191,6 +198,10 @@ struct interaction_t {
   float t[N];
 
   uint32_t flags[N];
+  // the surface that was hit, as mesh id, and material id, and the
+  // face that was hit, as offset into the mesh's indices
+  uint32_t mesh[N];
+  uint32_t face[N];
 
   soa::vector3_t<N> e;
   bsdf_t* bsdf[N];
@@ -205,6 +216,8 @@ struct interaction_t {
     n.from(to, o->n.at(from));
     e.from(to, o->e.at(from));
     flags[to] = o->flags[from];
+    mesh[to] = o->mesh[from];
+    face[to] = o->face[from];
     s[to] = o->s[from];
     t[to] = o->t[from];
     bsdf[to] = o->bsdf[from];
@@ -231,6 +244,10 @@ struct interaction_t {
   inline bool is_specular(uint32_t i) const {
     return (flags[i] & SPECULAR) == SPECULAR;
   }
+
+  inline uint32_t meshid(uint32_t i) const {
+    return mesh[i] & 0x0000ffff;
+  }
 };
 
 /* Emitted by the material system to represent the result of 
@@ -29,6 +29,10 @@ struct triangle_t {
 
   Imath::V3f barycentric_to_point(const Imath::V2f& uv) const;
 
+  /* texture coordinates of the mesh at a point, given in the same
+   * barycentric coordinates as for barycentric_to_point */
+  Imath::V2f barycentric_to_st(const Imath::V2f& uv) const;
+
   /* convert a sample from the unit square to barycentric coordinates
    * on a triangle */
   static Imath::V2f sample(const Imath::V2f& uv);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace numa {
+  /* The cpus of every numa node of the machine, as the kernel reports
+   * them in sysfs. Machines without numa information look like a
+   * single node with all cpus */
+  struct topology_t {
+    std::vector<std::vector<uint32_t>> nodes;
+
+    inline topology_t() {
+      for (auto node=0u;; ++node) {
+        std::ifstream in(
+          "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+        if (!in) {
+          break;
+        }
+
+        std::string list;
+        std::getline(in, list);
+
+        const auto cpus = parse(list);
+        if (!cpus.empty()) {
+          nodes.push_back(cpus);
+        }
+      }
+
+      if (nodes.empty()) {
+        nodes.emplace_back();
+        for (auto i=0u; i<std::max(std::thread::hardware_concurrency(), 1u); ++i) {
+          nodes.back().push_back(i);
+        }
+      }
+    }
+
+    inline uint32_t num_nodes() const {
+      return nodes.size();
+    }
+
+    /* threads fill up one node after the other, so threads with
+     * neighbouring indices share a node */
+    inline void place(uint32_t thread, uint32_t& node, uint32_t& cpu) const {
+      auto num = 0u;
+      for (const auto& cpus : nodes) {
+        num += cpus.size();
+      }
+
+      auto i = thread % num;
+      for (node=0; node<nodes.size(); ++node) {
+        if (i < nodes[node].size()) {
+          cpu = nodes[node][i];
+          return;
+        }
+        i -= nodes[node].size();
+      }
+    }
+
+    /* a cpu list like "0-3,8-11" */
+    static inline std::vector<uint32_t> parse(const std::string& list) {
+      std::vector<uint32_t> out;
+      std::stringstream ss(list);
+      std::string range;
+
+      while (std::getline(ss, range, ',')) {
+        if (range.empty()) {
+          continue;
+        }
+
+        const auto dash  = range.find('-');
+        const auto first = (uint32_t) std::stoul(range.substr(0, dash));
+        const auto last  = dash == std::string::npos ?
+          first : (uint32_t) std::stoul(range.substr(dash + 1));
+
+        for (auto cpu=first; cpu<=last; ++cpu) {
+          out.push_back(cpu);
+        }
+      }
+
+      return out;
+    }
+  };
+
+  /* restrict the calling thread to a single cpu */
+  inline bool pin(uint32_t cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+  }
+
+  /* write to every page of a block of memory, so the kernel backs it
+   * with memory on the node of the calling thread */
+  inline void touch(void* mem, size_t size) {
+    static const size_t PAGE_SIZE = 4096;
+
+    auto p = (volatile char*) mem;
+    for (size_t i=0; i<size; i+=PAGE_SIZE) {
+      p[i] = 0;
+    }
+  }
+}
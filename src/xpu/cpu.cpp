@@ -8,19 +8,34 @@
 
 #include "accel/bvh.hpp"
 #include "accel/bvh/binned_sah_builder.hpp"
+#include "accel/bvh/cache.hpp"
 
 #include "kernels/cpu/camera.hpp"
+#include "kernels/cpu/ray_sort.hpp"
 #include "kernels/cpu/stream_bvh_kernel.hpp"
 // #include "kernels/cpu/linear_bvh_kernel.hpp"
 #include "kernels/cpu/deferred_shading_kernel.hpp"
 #include "kernels/cpu/spt.hpp"
 
 #include "utils/allocator.hpp"
-
+#include "utils/color.hpp"
+#include "utils/numa.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <random> 
+#include <string>
 #include <thread>
 #include <vector>
 
+#include <sys/time.h>
+
 struct cpu_t::details_t {
   parsed_options_t options;
   
@@ -28,39 +43,254 @@ struct cpu_t::details_t {
 
   accel::mbvh_t accel;
 
+  // cpus of the numa nodes of the machine
+  numa::topology_t topology;
+  // copies of the tree, one per numa node, if they are replicated
+  std::mutex replicas_mutex;
+  std::vector<std::unique_ptr<accel::mbvh_t>> replicas;
+
+  // traversal statistics, summed over all worker threads
+  std::mutex stats_mutex;
+  stream_mbvh_kernel_t::stats_t stats;
+  deferred_shading_kernel_t::stats_t shading;
+  // paths traced, over all worker threads
+  uint64_t paths;
+
+  /* the summed radiance of all progressive passes, for every pixel of
+   * the frame. threads only touch the pixels of the tiles they render,
+   * and passes are separated by a barrier, so this needs no lock */
+  struct accumulation_t {
+    uint32_t width, height;
+
+    std::vector<float>    radiance; // 3 floats per pixel
+    std::vector<float>    normals;  // 3 floats per pixel, from the first pass
+    std::vector<uint32_t> paths;    // number of paths added to a pixel
+
+    inline void reset(uint32_t w, uint32_t h) {
+      width  = w;
+      height = h;
+
+      radiance.assign(w * h * 3, 0.0f);
+      normals.assign(w * h * 3, 0.0f);
+      paths.assign(w * h, 0);
+    }
+  } accumulation;
+
+  /* threads wait for each other at the end of a progressive pass. the
+   * last thread to arrive runs some code, before all threads continue */
+  struct barrier_t {
+    std::mutex m;
+    std::condition_variable cv;
+
+    uint32_t waiting;
+    uint32_t generation;
+
+    inline barrier_t()
+      : waiting(0), generation(0)
+    {}
+
+    template<typename F>
+    inline void wait(uint32_t num, const F& last) {
+      std::unique_lock<std::mutex> lock(m);
+
+      if (++waiting == num) {
+        last();
+
+        waiting = 0;
+        ++generation;
+        cv.notify_all();
+      }
+      else {
+        const auto current = generation;
+        cv.wait(lock, [this, current]() { return generation != current; });
+      }
+    }
+  } pass_barrier;
+
+  typedef std::chrono::steady_clock clock_type;
+
+  // when rendering started, and when the last intermediate image
+  // was published
+  clock_type::time_point started;
+  clock_type::time_point published;
+  bool has_published;
+
+  // with a time limit, no new samples are started after the deadline
+  clock_type::time_point deadline;
+  bool has_deadline;
+  // set once progressive rendering ran out of time, by the last thread
+  // to finish a pass
+  bool stopped;
+
   details_t(const parsed_options_t& options)    
     : options(options)
+    , paths(0)
+    , has_published(false)
+    , has_deadline(false)
+    , stopped(false)
   {}
 
+  inline bool expired() const {
+    return has_deadline && clock_type::now() >= deadline;
+  }
+
+  void add(
+    const stream_mbvh_kernel_t::stats_t& thread_stats
+  , const deferred_shading_kernel_t::stats_t& thread_shading
+  , uint64_t thread_paths)
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats.add(thread_stats);
+    shading.add(thread_shading);
+    paths += thread_paths;
+  }
+
+  /* the tree render threads on a numa node trace against. replicas
+   * get created by the first thread of a node that asks for one */
+  const accel::mbvh_t* tree(uint32_t node) {
+    if (!options.replicate_bvh || topology.num_nodes() < 2) {
+      return &accel;
+    }
+
+    std::lock_guard<std::mutex> lock(replicas_mutex);
+
+    replicas.resize(topology.num_nodes());
+
+    if (!replicas[node]) {
+      replicas[node].reset(new accel::mbvh_t());
+      replicas[node]->replicate(accel);
+    }
+
+    return replicas[node].get();
+  }
+
   void reset(const scene_t& scene) {
+    replicas.clear();
     accel.reset();
-    
-    accel::mbvh_t::builder_t::scoped_t builder(accel.builder());
 
     std::vector<triangle_t> triangles;
     scene.triangles(triangles);
 
-    bvh::from(builder, triangles);
+    bvh::build_options_t build;
+    build.threads        = options.single_threaded ? 1 : std::thread::hardware_concurrency();
+    build.spatial_splits = options.spatial_splits;
+
+    timeval start;
+    gettimeofday(&start, 0);
+
+    std::string cache;
+    uint64_t key = 0;
+
+    if (!options.bvh_cache.empty()) {
+      key   = bvh::cache::key<accel::mbvh_t::width>(triangles, build);
+      cache = bvh::cache::path(options.bvh_cache, key);
+
+      if (accel.load(cache, key)) {
+        timeval end;
+        gettimeofday(&end, 0);
+
+        std::cout
+          << "BVH loaded from cache: " << cache << " in "
+          << ((end.tv_sec - start.tv_sec) +
+              ((end.tv_usec - start.tv_usec) / 1000000.0))
+          << " (" << accel.num_nodes << " nodes)"
+          << std::endl;
+
+        compress();
+        return;
+      }
+    }
+
+    {
+      accel::mbvh_t::builder_t::scoped_t builder(accel.builder());
+      bvh::from(builder, triangles, build);
+    }
+
+    if (options.verbose) {
+      timeval end;
+      gettimeofday(&end, 0);
+
+      std::cout
+        << "BVH build time: "
+        << ((end.tv_sec - start.tv_sec) +
+            ((end.tv_usec - start.tv_usec) / 1000000.0))
+        << " (" << triangles.size() << " triangles, "
+        << accel.num_nodes << " nodes, "
+        << build.threads << " threads"
+        << (build.spatial_splits ? ", spatial splits)" : ")")
+        << std::endl;
+    }
+
+    if (!cache.empty() && accel.store(cache, key)) {
+      std::cout << "BVH stored in cache: " << cache << std::endl;
+    }
+
+    compress();
+  }
+
+  void compress() {
+    if (!options.compress_bvh) {
+      return;
+    }
+
+    accel.compress();
+
+    std::cout
+      << "BVH nodes compressed: "
+      << (accel.num_nodes * sizeof(mbvh::node_t<accel::mbvh_t::width>)) / (1024*1024)
+      << "MB -> "
+      << (accel.num_nodes * sizeof(mbvh::compressed_node_t<accel::mbvh_t::width>)) / (1024*1024)
+      << "MB"
+      << std::endl;
   }
 };
 
 template<typename Accel>
 struct tile_renderer_t {
   typedef spt::state_t<> integrator_state_t;
+  typedef job::tiles_t::tile_t tile_t;
 
   static const uint32_t ALLOCATOR_SIZE = 1024*1024*100; // 100MB
   
   uint32_t spp;
   uint32_t pps;
 
+  cpu_t::details_t* details;
+
   frame_state_t& frame;
 
+  // in progressive mode, every tile is rendered once per pass, with
+  // 'samples_per_pass' samples per pixel, and added to the frame
+  // accumulation instead of the film
+  bool     progressive;
+  uint32_t samples_per_pass;
+  uint32_t pass;
+
   // rendering kernel functions
   camera::perspective_kernel_t camera_rays;
   Accel                        trace;
   deferred_shading_kernel_t    shade;
   spt::light_sampler_t         prepare_occlusion_queries;
   spt::integrator_t            integrate;
+  ray_sort_kernel_t            sort_rays;
+
+  // reorder secondary rays before tracing them
+  bool sort;
+  // start new paths as soon as other paths terminate, instead of
+  // waiting for all paths of a sample to finish
+  bool regenerate;
+
+  // with adaptive sampling, pixels get new paths until their noise
+  // is below a threshold, within a minimum, and maximum number of
+  // paths. otherwise all pixels get spp * pps paths
+  bool     adaptive;
+  uint32_t min_samples;
+  uint32_t max_samples;
+  float    noise_threshold;
+
+  // the time limit of the frame expired. checked whenever new paths
+  // get started
+  bool out_of_time;
 
   // renderer state
   integrator_state_t* integrator_state;
@@ -69,8 +299,42 @@ struct tile_renderer_t {
   allocator_t      allocator;
   active_t<>       active;
   ray_t<>*         rays;
-  interaction_t<>* primary;
   interaction_t<>* hits;
+  sampler_t::pixel_samples_t* pixel_samples;
+
+  // paths of the integrator state, that are not in use
+  active_t<>* idle;
+
+  // pixels, and samples of paths started in the current step
+  struct fresh_paths_t {
+    float    x[config::STREAM_SIZE];
+    float    y[config::STREAM_SIZE];
+    uint32_t pixel[config::STREAM_SIZE];
+    uint32_t sample[config::STREAM_SIZE];
+  } *fresh;
+
+  // every sample of every pixel of a tile is traced as one path. this
+  // is the number of paths in the current tile, and the next one to
+  // start, without adaptive sampling
+  uint32_t num_paths;
+  uint32_t next_path;
+
+  /* sample statistics of a pixel in the current tile */
+  struct pixel_t {
+    uint32_t started;  // number of paths started for the pixel
+    uint32_t finished; // number of paths that terminated
+    float    mean;     // mean luminance of the terminated paths
+    float    m2;       // sum of squared differences from the mean
+  } *pixels;
+
+  // pixels that still get new paths with adaptive sampling. new paths
+  // go to these pixels round robin
+  uint32_t* live;
+  uint32_t  num_live;
+  uint32_t  next_live;
+
+  // number of paths traced by this renderer
+  uint64_t paths;
 
   // output buffer for the rendered tile
   render_buffer_t buffer;
@@ -81,29 +345,73 @@ struct tile_renderer_t {
     render_buffer_t::channel_t* normals;
   } channels;
 
-  inline tile_renderer_t(const cpu_t* cpu, const scene_t& scene, frame_state_t& frame)
+  inline tile_renderer_t(
+    const cpu_t* cpu
+  , const scene_t& scene
+  , frame_state_t& frame
+  , const accel::mbvh_t* accel)
     : spp(cpu->spp)
     , pps(cpu->pps)
+    , details(cpu->details)
     , frame(frame)
-    , trace(&cpu->details->accel)
+    , progressive(cpu->progressive)
+    , samples_per_pass(std::max(cpu->details->options.samples_per_pass, 1u))
+    , pass(0)
+    , trace(accel, cpu->details->options.stream_threshold)
+    , shade(cpu->details->options.batch_shading)
     , prepare_occlusion_queries(cpu->details->options)
     , integrate(cpu->details->options)
+    , sort_rays(accel->bounds())
+    , sort(cpu->details->options.sort_rays)
+    , regenerate(cpu->details->options.regenerate_paths)
+    , adaptive(cpu->spp == 0)
+    , min_samples(cpu->details->options.min_samples)
+    , max_samples(std::max(cpu->details->options.max_samples, 1u))
+    , noise_threshold(cpu->details->options.noise_threshold)
+    , out_of_time(false)
+    , paths(0)
     , allocator(ALLOCATOR_SIZE)
     , buffer(frame.tiles->format)
   {
+    // pinned threads fault in their arena right away, so it ends up on
+    // their own numa node
+    if (cpu->details->options.pin_threads) {
+      numa::touch(allocator.mem, allocator.size);
+    }
+
     integrator_state = new(allocator) spt::state_t<>(&scene, frame.sampler);
 
     channels.primary = buffer.channel(render_buffer_t::PRIMARY);
     channels.normals = buffer.channel(render_buffer_t::NORMALS);
   }
 
-  /* allocate dynamic memory used to render a tile */
-  inline void prepare_tile(const job::tiles_t::tile_t& tile) {
+  /* allocate dynamic memory used to render a tile, and reset the
+   * integrator state */
+  inline void prepare_tile(const tile_t& tile) {
     rays = new(allocator) ray_t<>();
-    primary = new(allocator) interaction_t<>();
     hits = new(allocator) interaction_t<>();
+    pixel_samples = new(allocator) sampler_t::pixel_samples_t();
+    fresh = new(allocator) fresh_paths_t();
 
-    // memset(primary, 0, sizeof(interaction_t<>));
+    idle = new(allocator) active_t<>();
+    idle->reset(0);
+
+    active.clear();
+
+    integrator_state->finished.clear();
+
+    num_paths = tile.num_pixels() * samples_per_tile() * pps;
+    next_path = 0;
+
+    pixels = new(allocator) pixel_t[tile.num_pixels()];
+    memset(pixels, 0, sizeof(pixel_t) * tile.num_pixels());
+
+    live = new(allocator) uint32_t[tile.num_pixels()];
+    for (auto i=0; i<tile.num_pixels(); ++i) {
+      live[i] = i;
+    }
+    num_live  = tile.num_pixels();
+    next_live = 0;
 
     // allocate memory based on the tiles render buffer format
     // this will allocate memory for channels in the buffer, like 
@@ -112,97 +420,356 @@ struct tile_renderer_t {
     buffer.allocate(allocator, tile.w, tile.h);
   }
 
-  /* setup primary rays, and reset the integrator state */
-  inline void prepare_sample(
-    const job::tiles_t::tile_t& tile
-  , uint32_t sample
-  , const scene_t& scene)
-  {
-    active.reset(0);
+  /* number of pixel samples of the current tile */
+  inline uint32_t samples_per_tile() const {
+    if (!progressive) {
+      return spp;
+    }
+    return std::min(samples_per_pass, spp - pass * samples_per_pass);
+  }
+
+  /* the number of progressive passes needed for all samples */
+  inline uint32_t passes() const {
+    return progressive ? (spp + samples_per_pass - 1) / samples_per_pass : 1;
+  }
+
+  /* the relative standard error of the mean luminance of a pixel is
+   * below the noise threshold */
+  inline bool is_converged(const pixel_t& pixel) const {
+    static const float MIN_LUMINANCE = 0.001f;
+
+    if (pixel.finished < std::max(min_samples, 2u)) {
+      return false;
+    }
+
+    const auto variance = pixel.m2 / (pixel.finished - 1);
+    const auto error    = std::sqrt(variance / pixel.finished);
+
+    return error < noise_threshold * std::max(pixel.mean, MIN_LUMINANCE);
+  }
+
+  /* pick the pixel, and the sample of the pixel, the next path is
+   * traced for. returns false if no pixel can take another path right
+   * now */
+  inline bool next_sample(const tile_t& tile, uint32_t& pixel, uint32_t& sample) {
+    if (!adaptive) {
+      if (next_path >= num_paths || out_of_time) {
+        return false;
+      }
+
+      // samples of later passes continue the sequences of a pixel
+      const auto first = progressive ? pass * samples_per_pass * pps : 0;
+
+      pixel  = next_path % tile.num_pixels();
+      sample = first + pixels[pixel].started++;
+      ++next_path;
+
+      return true;
+    }
+
+    // pixels only get a limited number of paths at once, so a few
+    // pixels left over at the end of a tile don't get all the paths
+    // of the stream, before their convergence is checked again
+    const auto max_in_flight = std::max(min_samples, 1u);
+
+    // out of time, pixels only get their minimum number of paths
+    const auto limit = out_of_time ? max_in_flight : max_samples;
+
+    for (auto tries=num_live; num_live > 0 && tries > 0; --tries) {
+      if (next_live >= num_live) {
+        next_live = 0;
+      }
+
+      const auto candidate = live[next_live];
+      auto& stats = pixels[candidate];
+
+      if (is_converged(stats) || stats.started >= limit) {
+        live[next_live] = live[--num_live];
+        continue;
+      }
+
+      if (stats.started - stats.finished >= max_in_flight) {
+        ++next_live;
+        continue;
+      }
+
+      pixel  = candidate;
+      sample = stats.started++;
+
+      if (stats.started >= limit) {
+        live[next_live] = live[--num_live];
+      }
+      else {
+        ++next_live;
+      }
+
+      return true;
+    }
+
+    return false;
+  }
+
+  /* start paths for the next samples of the tile, with all idle paths
+   * of the integrator. camera rays of the new paths are appended to the
+   * rays of the paths still in flight */
+  inline void start_paths(const tile_t& tile, const scene_t& scene) {
+    const auto& camera = scene.camera;
 
-    integrator_state->reset();
+    const auto first = active.num;
 
-    // memset(hits, 0, sizeof(interaction_t<>));
+    out_of_time = details->expired();
 
-    const auto& samples = frame.sampler->next_pixel_samples(sample);
-    const auto& camera  = scene.camera;
+    uint32_t pixel, sample;
 
-    camera_rays(camera, tile, samples, rays);
+    auto num = 0u;
+    while (idle->num > 0 && next_sample(tile, pixel, sample)) {
+      const auto path = idle->index[--idle->num];
+
+      const auto x = tile.x + pixel % tile.w;
+      const auto y = tile.y + pixel / tile.w;
+
+      fresh->x[num]      = x;
+      fresh->y[num]      = y;
+      fresh->pixel[num]  = y * camera.film.width + x;
+      fresh->sample[num] = sample;
+
+      integrator_state->start(path, fresh->pixel[num], pixel, sample);
+      active.add(path);
+      ++num;
+    }
+
+    if (num == 0) {
+      return;
+    }
+
+    frame.sampler->pixel_samples(
+      fresh->pixel, fresh->sample, num, *pixel_samples);
+
+    camera_rays(camera, fresh->x, fresh->y, *pixel_samples, num, rays, first);
   }
 
-  inline void trace_primary_rays(const scene_t& scene) {
-    trace_rays(scene, primary);
+  /* add the radiance of terminated paths to the tile, and make their
+   * slots in the integrator state available to new paths */
+  inline void finish_paths(const tile_t& tile) {
+    auto& finished = integrator_state->finished;
+
+    for (auto i=0; i<finished.num; ++i) {
+      const auto path  = finished.index[i];
+      const auto pixel = integrator_state->tile_pixel[path];
+      const auto r     = integrator_state->r.at(path);
+
+      // FIXME: temporary code to copy radiance values into output buffer
+      // this should run through a filter kernel instead
+      if (channels.primary) {
+        channels.primary->add(pixel % tile.w, pixel / tile.w, r);
+      }
+
+      // welford's online algorithm for the variance of the pixel
+      auto& stats = pixels[pixel];
+      const auto y = color::y(r);
+      const auto delta = y - stats.mean;
+      ++stats.finished;
+      stats.mean += delta / stats.finished;
+      stats.m2   += delta * (y - stats.mean);
+
+      idle->add(path);
+    }
+
+    paths += finished.num;
+
+    finished.clear();
   }
 
-  inline void trace_and_advance_paths(const scene_t& scene) {
-    trace_rays(scene, hits);
+  /* turn the summed radiance of all paths of a pixel into its mean */
+  inline void normalize_tile(const tile_t& tile) {
+    if (!channels.primary) {
+      return;
+    }
+
+    for (auto i=0; i<tile.num_pixels(); ++i) {
+      const auto x = i % tile.w;
+      const auto y = i / tile.w;
+
+      if (pixels[i].finished > 0) {
+        channels.primary->scale(x, y, 1.0f / pixels[i].finished);
+      }
+    }
+  }
+
+  /* store the normals at the first hit of new paths */
+  inline void record_normals(const tile_t& tile) {
+    if (!channels.normals) {
+      return;
+    }
+
+    for (auto i=0; i<active.num; ++i) {
+      const auto path = active.index[i];
+
+      if (integrator_state->depth[path] == 0 && hits->is_hit(i)) {
+        const auto pixel = integrator_state->tile_pixel[path];
+        channels.normals->set(pixel % tile.w, pixel / tile.w, hits->n.at(i));
+      }
+    }
   }
 
   /** 
    * The basic render pipleine step. 
    * trace rays -> evaluate materials at hit points -> 
-   * find occlusion queries -> trace occlusion query rays -> 
+   * find occlusion queries -> trace occlusion query rays (any hit) -> 
    * compute radiance values -> generate new paths vertices 
    *
    */
-  inline void trace_rays(const scene_t& scene, interaction_t<>* out) {
-    trace(rays, active);
-    shade(allocator, scene, active, rays, out);
-    prepare_occlusion_queries(integrator_state, active, primary, out, rays);
+  inline void trace_and_advance_paths(const tile_t& tile, const scene_t& scene) {
+    if (sort) {
+      sort_rays(allocator, active, rays);
+    }
     trace(rays, active);
-    integrate(integrator_state, active, primary, out, rays);
+    shade(allocator, scene, active, rays, hits);
+    record_normals(tile);
+    prepare_occlusion_queries(integrator_state, active, hits, rays);
+    trace.occluded(rays, active);
+    integrate(
+      integrator_state, active, hits, rays
+    , shade.buckets.material, shade.buckets.size);
   }
 
-  inline void render_tile(const job::tiles_t::tile_t& tile, const scene_t& scene) {
+  inline void render_tile(const tile_t& tile, const scene_t& scene) {
     allocator_scope_t tile_scope(allocator);
     prepare_tile(tile);
 
-    for (auto j=0; j<spp; ++j) {
-      // free per sample state for every sample
-      allocator_scope_t sample_scope(allocator);
+    start_paths(tile, scene);
 
-      prepare_sample(tile, j, scene);
-      trace_primary_rays(scene);
+    while (active.has_live_paths()) {
+      // clear temporary shading data, for every path segment
+      allocator_scope_t inner_scope(allocator);
+      trace_and_advance_paths(tile, scene);
+      finish_paths(tile);
 
-      while (active.has_live_paths()) {
-        // clear temporary shading data, for every path segment
-        allocator_scope_t inner_scope(allocator);
-        trace_and_advance_paths(scene);
+      // without regeneration, the next sample of the tile starts once
+      // all paths of the previous one terminated
+      if (regenerate || !active.has_live_paths()) {
+        start_paths(tile, scene);
       }
+    }
 
-      // FIXME: temporary code to copy radiance values into output buffer
-      // this should run through a filter kernel instead
-      for (auto y=0; y<tile.h; ++y) {
-        for (auto x=0; x<tile.w; ++x) {
-          const auto k = y * tile.w + x;
-          const auto r = integrator_state->r.at(k);
-
-          if (channels.primary) {
-            // if (std::isnan(r.x) || std::isnan(r.y) || std::isnan(r.z)) {
-            //   std::cout << "Path is Nan" << std::endl;
-            // }
-            // if (std::isinf(r.x) || std::isinf(r.y) || std::isinf(r.z)) {
-            //   std::cout << "Path is Nan" << std::endl;
-            // }
-            // if (r.x > 1000.0f || r.y > 1000.0f || r.z > 1000.0f) {
-            //   std::cout << "Path is Firefly" << std::endl;
-            // }
-
-            channels.primary->add(x, y, r * (1.0f / (spp * pps)));
-          }
-
-          if (channels.normals && primary->is_hit(k)) {
-            channels.normals->set(x, y, primary->n.at(k));
-          }
-        }
-      }
+    if (progressive) {
+      accumulate_tile(tile);
+      return;
     }
 
+    normalize_tile(tile);
+
     frame.film->add_tile(
       Imath::V2i(tile.x, tile.y)
     , Imath::V2i(tile.w, tile.h)
     , buffer);
   }
+
+  /* add the summed radiance of the paths of a tile to the frame */
+  inline void accumulate_tile(const tile_t& tile) {
+    auto& acc = details->accumulation;
+
+    float v[4];
+
+    for (auto i=0; i<tile.num_pixels(); ++i) {
+      const auto x = i % tile.w;
+      const auto y = i / tile.w;
+      const auto p = (tile.y + y) * acc.width + tile.x + x;
+
+      if (channels.primary) {
+        channels.primary->get(x, y, v);
+        acc.radiance[p*3  ] += v[0];
+        acc.radiance[p*3+1] += v[1];
+        acc.radiance[p*3+2] += v[2];
+      }
+
+      if (channels.normals && pass == 0) {
+        channels.normals->get(x, y, v);
+        acc.normals[p*3  ] = v[0];
+        acc.normals[p*3+1] = v[1];
+        acc.normals[p*3+2] = v[2];
+      }
+
+      acc.paths[p] += pixels[i].finished;
+    }
+  }
+
+  /* send the mean radiance of all passes so far to the film, and
+   * publish it as an intermediate image */
+  inline void publish() {
+    const auto& acc = details->accumulation;
+
+    for (const auto& tile : frame.tiles->all) {
+      allocator_scope_t scope(allocator);
+      buffer.allocate(allocator, tile.w, tile.h);
+
+      for (auto i=0; i<tile.num_pixels(); ++i) {
+        const auto x = i % tile.w;
+        const auto y = i / tile.w;
+        const auto p = (tile.y + y) * acc.width + tile.x + x;
+
+        if (channels.primary && acc.paths[p] > 0) {
+          const auto s = 1.0f / acc.paths[p];
+          channels.primary->set(x, y, Imath::V3f(
+            acc.radiance[p*3], acc.radiance[p*3+1], acc.radiance[p*3+2]) * s);
+        }
+
+        if (channels.normals) {
+          channels.normals->set(x, y, Imath::V3f(
+            acc.normals[p*3], acc.normals[p*3+1], acc.normals[p*3+2]));
+        }
+      }
+
+      frame.film->add_tile(
+        Imath::V2i(tile.x, tile.y)
+      , Imath::V2i(tile.w, tile.h)
+      , buffer);
+    }
+
+    frame.film->publish();
+  }
+
+  /* wait for all threads to finish the current pass. the last thread
+   * publishes an image, if the previous one is old enough, and hands
+   * out the tiles of the next pass */
+  inline void end_pass(uint32_t threads) {
+    details->pass_barrier.wait(threads, [&]() {
+      const auto expired = details->expired() && pass + 1 < passes();
+      const auto last    = expired || pass + 1 >= passes();
+
+      if (expired) {
+        std::cout
+          << "Time limit reached after " << pass + 1 << " of " << passes() << " passes"
+          << std::endl;
+      }
+
+      const auto now = cpu_t::details_t::clock_type::now();
+      const auto age = std::chrono::duration<float>(now - details->published).count();
+
+      if (last || !details->has_published || age >= details->options.publish_interval) {
+        publish();
+
+        if (!details->has_published && details->options.verbose) {
+          std::cout
+            << "First image after: "
+            << std::chrono::duration<float>(now - details->started).count()
+            << std::endl;
+        }
+
+        details->published     = now;
+        details->has_published = true;
+      }
+
+      if (last) {
+        details->stopped = true;
+      }
+      else {
+        frame.tiles->reset();
+      }
+    });
+
+    ++pass;
+  }
 };
 
 cpu_t::cpu_t(const parsed_options_t& options)
@@ -210,7 +777,24 @@ cpu_t::cpu_t(const parsed_options_t& options)
   , concurrency(options.single_threaded ? 1 : std::thread::hardware_concurrency())
   , spp(options.samples_per_pixel)
   , pps(options.paths_per_sample)
-{}
+  , progressive(options.progressive)
+{
+  if (progressive && spp == 0) {
+    std::cout
+      << "Adaptive sampling doesn't support progressive rendering, rendering tiles"
+      << std::endl;
+    progressive = false;
+  }
+
+  // with a time limit, and a fixed number of samples, passes over the
+  // whole frame make sure every pixel got samples when time runs out.
+  // with adaptive sampling, pixels drop to their minimum number of
+  // samples instead
+  if (options.time_limit > 0.0f && spp > 0 && !progressive) {
+    std::cout << "Rendering progressively, to respect the time limit" << std::endl;
+    progressive = true;
+  }
+}
 
 cpu_t::~cpu_t() {
   delete details;
@@ -221,18 +805,60 @@ void cpu_t::preprocess(const scene_t& scene) {
 }
 
 void cpu_t::start(const scene_t& scene, frame_state_t& frame) {
+  details->started       = details_t::clock_type::now();
+  details->has_published = false;
+  details->stopped       = false;
+
+  const auto limit = details->options.time_limit;
+  details->has_deadline = limit > 0.0f;
+  details->deadline     = details->started +
+    std::chrono::duration_cast<details_t::clock_type::duration>(
+      std::chrono::duration<float>(limit));
+
+  if (progressive) {
+    details->accumulation.reset(frame.tiles->width, frame.tiles->height);
+  }
+
+  if (details->options.pin_threads && details->options.verbose) {
+    std::cout
+      << "Pinning " << concurrency << " render threads to cpus of "
+      << details->topology.num_nodes() << " numa nodes"
+      << (details->options.replicate_bvh ? ", with a BVH per node" : "")
+      << std::endl;
+  }
+
   for (auto i=0; i<concurrency; ++i) {
     details->threads.push_back(std::thread(
       [i, this](const scene_t& scene, frame_state_t& frame) {
+        // pin the thread before it allocates anything, so its memory
+        // gets placed on its numa node
+        uint32_t node = 0, cpu = 0;
+        if (details->options.pin_threads) {
+          details->topology.place(i, node, cpu);
+
+          if (!numa::pin(cpu)) {
+            std::cerr << "Failed to pin render thread " << i << " to cpu " << cpu << std::endl;
+          }
+        }
+
       	// create per thread state in the shading system
       	material_t::attach();
 
-        tile_renderer_t<stream_mbvh_kernel_t> renderer(this, scene, frame);
+        tile_renderer_t<stream_mbvh_kernel_t> renderer(this, scene, frame, details->tree(node));
 
       	job::tiles_t::tile_t tile;
-      	while (frame.tiles->next(tile)) {
-          renderer.render_tile(tile, scene);
-      	}
+        for (auto pass=0; pass<renderer.passes() && !details->stopped; ++pass) {
+          // once out of time, the tiles left in a pass are skipped
+          while ((!progressive || !details->expired()) && frame.tiles->next(i, tile)) {
+            renderer.render_tile(tile, scene);
+          }
+
+          if (progressive) {
+            renderer.end_pass(concurrency);
+          }
+        }
+
+        details->add(renderer.trace.stats(), renderer.shade.stats, renderer.paths);
       }, std::cref(scene), std::ref(frame)));
   }
 }
@@ -241,6 +867,36 @@ void cpu_t::join() {
   for (auto& thread : details->threads) {
     thread.join();
   }
+
+  if (details->options.verbose) {
+    const auto& stats   = details->stats;
+    const auto& shading = details->shading;
+
+    std::cout
+      << "Paths traced: " << details->paths
+      << std::endl
+      << "Rays traced: " << stats.rays
+      << ", nodes visited per ray: "
+      << (stats.rays ? (double) stats.nodes / stats.rays : 0.0)
+      << ", rays per stream: "
+      << (stats.streams ? (double) stats.rays / stats.streams : 0.0)
+      << std::endl
+      << "Stream node visits: " << stats.stream_tasks
+      << ", rays switched to single ray traversal: " << stats.single_rays
+      << std::endl
+      << "Leaf packet utilization: "
+      << (stats.leaf_packets ? (double) stats.leaf_rays / (stats.leaf_packets * accel::mbvh_t::width) : 0.0)
+      << std::endl
+      << "Lane storage per thread: " << stats.lane_bytes / 1024 << "KB"
+      << ", most rays in a lane: " << stats.lane_peak
+      << std::endl
+      << "Points shaded: " << shading.points
+      << ", points per batch: "
+      << (shading.batches ? (double) shading.points / shading.batches : 0.0)
+      << ", points per second per thread: "
+      << (shading.nanoseconds ? shading.points / (shading.nanoseconds * 1e-9) : 0.0)
+      << std::endl;
+  }
 }
 
 cpu_t* cpu_t::make(const parsed_options_t& options) {